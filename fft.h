@@ -31,6 +31,11 @@
 // Used only if not defined __VNA_USE_MATH_TABLES__ (use self table for TTF or direct sin/cos calculations)
 #define FFT_USE_SIN_COS_TABLE
 
+// Use radix-4 kernel (for odd log2(n) first stage radix-2, it have zero twiddle), need 3 complex multiply for 4 points
+// (radix-2 need 4) and skip multiply for zero twiddle, so use ~2 times less multiply (2052 vs 4096 for 256 size),
+// little increase code size. Kernel select for all FFT sizes (not depend from FFT_SIZE)
+#define FFT_USE_RADIX4
+
 // Use sin table and interpolation for sin/sos calculations
 #ifdef __VNA_USE_MATH_TABLES__
 // Use 512 table for calculation sin/cos value, also use this table for FFT
@@ -256,19 +261,38 @@ static const float sin_table_512[] = {
 
 #endif // __VNA_USE_MATH_TABLES__
 
-static uint16_t reverse_bits(uint16_t x, int n) {
-	uint16_t result = 0;
-	int i;
-	for (i = 0; i < n; i++, x >>= 1)
-		result = (result << 1) | (x & 1U);
-	return result;
+// Bit reverse table for 8 bit, generated at compile time
+#define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+static const uint8_t bit_reverse_256[256] = {
+	R6(0), R6(2), R6(1), R6(3)
+};
+#undef R2
+#undef R4
+#undef R6
+
+// Reverse n bits of x (n <= 16)
+static inline uint16_t reverse_bits(uint16_t x, int n) {
+	if (n <= 8)
+		return bit_reverse_256[x] >> (8 - n);
+	return ((bit_reverse_256[x & 0xFF] << 8) | bit_reverse_256[x >> 8]) >> (16 - n);
 }
 
-/***
- * dir = forward: 0, inverse: 1
- * https://www.nayuki.io/res/free-small-fft-in-multiple-languages/fft.c
- */
-static void fft(float array[][2], const uint8_t dir) {
+#ifdef FFT_USE_RADIX4
+// Return sin/cos for k = 0 .. FFT_SIZE - 1 (table store only 0 .. FFT_SIZE/2 part)
+static inline void fft_sin_cos(uint16_t k, float *s, float *c) {
+	if (k > FFT_SIZE / 2) {
+		k-= FFT_SIZE / 2;
+		*s = -FFT_SIN(k);
+		*c = -FFT_COS(k);
+	} else {
+		*s =  FFT_SIN(k);
+		*c =  FFT_COS(k);
+	}
+}
+#endif
+
 // FFT_SIZE = 2^FFT_N
 #if   FFT_SIZE == 256
  #define FFT_N     8
@@ -277,8 +301,14 @@ static void fft(float array[][2], const uint8_t dir) {
 #else
  #error "Need define FFT_N for this FFT size"
 #endif
-	const uint16_t n = FFT_SIZE;
-	const uint8_t levels = FFT_N; // log2(n)
+
+/***
+ * dir = forward: 0, inverse: 1
+ * levels = log2(n), n <= FFT_SIZE (sin/cos table used with FFT_SIZE / n step)
+ * https://www.nayuki.io/res/free-small-fft-in-multiple-languages/fft.c
+ */
+static void fft(float array[][2], const uint8_t levels, const uint8_t dir) {
+	const uint16_t n = 1 << levels;
 
 	const uint8_t real =   dir & 1;
 	const uint8_t imag = ~real & 1;
@@ -295,12 +325,58 @@ static void fft(float array[][2], const uint8_t dir) {
 			array[j][imag] = temp;
 		}
 	}
+	uint16_t j, k;
+#ifdef FFT_USE_RADIX4
+	uint16_t h = 1;
+	// Odd log2(n), first radix-2 stage (zero twiddle)
+	if (levels & 1) {
+		for (i = 0; i < n; i+=2) {
+			float tpre = array[i + 1][real];
+			float tpim = array[i + 1][imag];
+			array[i + 1][real] = array[i][real] - tpre;
+			array[i + 1][imag] = array[i][imag] - tpim;
+			array[i][real] += tpre;
+			array[i][imag] += tpim;
+		}
+		h = 2;
+	}
+	// Cooley-Tukey decimation-in-time radix-4 FFT (two radix-2 stages in one pass)
+	for (; h < n; h<<=2) {
+		uint16_t tablestep = FFT_SIZE / (4 * h);
+		for (i = 0; i < n; i+=4*h) {
+			for (j = i, k = 0; j < i + h; j++, k += tablestep) {
+				float r0 = array[j      ][real], i0 = array[j      ][imag];
+				float r1 = array[j +   h][real], i1 = array[j +   h][imag];
+				float r2 = array[j + 2*h][real], i2 = array[j + 2*h][imag];
+				float r3 = array[j + 3*h][real], i3 = array[j + 3*h][imag];
+				if (k) {
+					// x1 * w^2k, x2 * w^k, x3 * w^3k, w = exp(-j*2*pi/FFT_SIZE)
+					float s, c, t;
+					fft_sin_cos(2 * k, &s, &c);
+					t  = r1 * c + i1 * s; i1 = i1 * c - r1 * s; r1 = t;
+					fft_sin_cos(    k, &s, &c);
+					t  = r2 * c + i2 * s; i2 = i2 * c - r2 * s; r2 = t;
+					fft_sin_cos(3 * k, &s, &c);
+					t  = r3 * c + i3 * s; i3 = i3 * c - r3 * s; r3 = t;
+				}
+				float ar = r0 + r1, ai = i0 + i1;
+				float br = r0 - r1, bi = i0 - i1;
+				float cr = r2 + r3, ci = i2 + i3;
+				float dr = r2 - r3, di = i2 - i3;
+				array[j      ][real] = ar + cr; array[j      ][imag] = ai + ci;
+				array[j + 2*h][real] = ar - cr; array[j + 2*h][imag] = ai - ci;
+				// b -/+ j * d
+				array[j +   h][real] = br + di; array[j +   h][imag] = bi - dr;
+				array[j + 3*h][real] = br - di; array[j + 3*h][imag] = bi + dr;
+			}
+		}
+	}
+#else
 	const uint16_t size = 2;
 	uint16_t halfsize = size / 2;
-	uint16_t tablestep = n / size;
-	uint16_t j, k;
+	uint16_t tablestep = FFT_SIZE / size;
 	// Cooley-Tukey decimation-in-time radix-2 FFT
-	for (;tablestep; tablestep>>=1, halfsize<<=1) {
+	for (;halfsize < n; tablestep>>=1, halfsize<<=1) {
 		for (i = 0; i < n; i+=2*halfsize) {
 			for (j = i, k = 0; j < i + halfsize; j++, k += tablestep) {
 				uint16_t l = j + halfsize;
@@ -315,14 +391,46 @@ static void fft(float array[][2], const uint8_t dir) {
 			}
 		}
 	}
+#endif
 }
 
 static inline void fft_forward(float array[][2]) {
-	fft(array, 0);
+	fft(array, FFT_N, 0);
 }
 
 static inline void fft_inverse(float array[][2]) {
-	fft(array, 1);
+	fft(array, FFT_N, 1);
+}
+
+/***
+ * Inverse FFT for real result, input is Hermitian (X[FFT_SIZE - k] = conj(X[k])), so need only FFT_SIZE/2 complex fft
+ * array: input X[0..FFT_SIZE/2-1] (imaginary part of X[0] and X[FFT_SIZE/2] assumed zero)
+ * output: real x[n] = ((float *)array)[n], n = 0..FFT_SIZE-1
+ * Result not normalized (same as fft_inverse result)
+ */
+static void fft_real_inverse(float array[][2]) {
+	const uint16_t n = FFT_SIZE / 2;
+	uint16_t k, j;
+	// Pack even and odd samples as z[m] = x[2m] + j * x[2m+1], z = ifft(Z), for k = 0..n-1:
+	//   Z[k] = E + T, E = X[k] + conj(X[n-k]), T = j * (X[k] - conj(X[n-k])) * exp(+j*2*pi*k/FFT_SIZE)
+	//   Z[n-k] = conj(E - T)
+	array[0][1] = array[0][0];
+	for (k = 1; k <= n / 2; k++) {
+		j = n - k;
+		float s = FFT_SIN(k);
+		float c = FFT_COS(k);
+		float er = array[k][0] + array[j][0];
+		float ei = array[k][1] - array[j][1];
+		float dr = array[k][0] - array[j][0];
+		float di = array[k][1] + array[j][1];
+		float tr = -dr * s - di * c;
+		float ti =  dr * c - di * s;
+		array[k][0] = er + tr;
+		array[k][1] = ei + ti;
+		array[j][0] = er - tr;
+		array[j][1] = ti - ei;
+	}
+	fft(array, FFT_N - 1, 1);
 }
 
 // Return sin/cos value angle in range 0.0 to 1.0 (0 is 0 degree, 1 is 360 degree)
@@ -383,3 +491,101 @@ void vna_sin_cos(float angle, float * pSinVal, float * pCosVal)
     *pSinVal = -*pSinVal;
 #endif
 }
+
+// Return log10(x), x = m * 2^e, log(m) from atanh series: log(m) = 2 * atanh((m - 1) / (m + 1))
+// polynomial coefficients fitted for m in range sqrt(0.5) to sqrt(2), max error 2e-8
+float vna_log10f(float x)
+{
+#ifndef __VNA_USE_MATH_TABLES__
+  return log10f(x);
+#else
+  union {float f; uint32_t i;} u = {x};
+  if (!(x > 0.0f)) return x == 0.0f ? -INFINITY : NAN;
+  if (u.i >= 0x7F800000) return x; // infinity
+  int e = (u.i >> 23) - 127;
+  if (e == -127) {                 // denormal, normalize it
+    u.f = x * 8388608.0f;          // 2^23
+    e = (u.i >> 23) - 127 - 23;
+  }
+  u.i = (u.i & 0x007FFFFF) | 0x3F800000; // m = 1.0 ... 2.0
+  if (u.f > 1.41421356f) {u.f*= 0.5f; e++;}
+  float z = (u.f - 1.0f) / (u.f + 1.0f);
+  float z2 = z * z;
+  float ln_m = 2.0f * z * (1.00000012f + z2 * (0.333261334f + z2 * 0.206474546f));
+  // log10(x) = log(m) * log10(e) + e * log10(2)
+  return ln_m * 0.434294482f + e * 0.301029996f;
+#endif
+}
+
+// Return atan2(y, x) in radian, reduce to atan(z) for z = -tan(pi/8) ... tan(pi/8) (only one division)
+// polynomial coefficients fitted for this range, max error 1e-7
+float vna_atan2f(float y, float x)
+{
+#ifndef __VNA_USE_MATH_TABLES__
+  return atan2f(y, x);
+#else
+  float ax = fabsf(x), ay = fabsf(y);
+  float a = ax < ay ? ax : ay;
+  float b = ax < ay ? ay : ax;
+  float z, r;
+  if (b == 0.0f) return 0.0f;
+  if (a > 0.414213562f * b) {      // a / b > tan(pi/8), atan(a / b) = pi/4 + atan((a - b) / (a + b))
+    z = (a - b) / (a + b);
+    r = VNA_PI / 4;
+  } else {
+    z = a / b;
+    r = 0.0f;
+  }
+  float z2 = z * z;
+  r+= z * (0.999999981f + z2 * (-0.333327858f + z2 * (0.199740824f + z2 * (-0.138484902f + z2 * 0.0797629181f))));
+  if (ay > ax) r = VNA_PI / 2 - r;
+  if (x < 0.0f) r = VNA_PI - r;
+  return y < 0.0f ? -r : r;
+#endif
+}
+
+// Inverse Chirp-Z transform (Bluestein algorithm, convolution calculated by FFT_SIZE fft):
+//   x[m] = sum(X[n] * exp(+j*2*pi*n*(f0 + m*df))), n = 0..n_in-1, m = 0..n_out-1
+// f0 and df in turns (for fft_inverse f0 = 0, df = 1/FFT_SIZE), need n_in + n_out - 1 <= FFT_SIZE
+// array: input X[n_in], output x[n_out] (both FFT_SIZE size), work: temporary FFT_SIZE buffer
+// Result not normalized (same as fft_inverse result)
+// Phase accumulated as fixed point 2^-32 turns, integer overflow is exact modulo 1 turn (no precision loss on big f0 or k^2)
+#define CZT_TURN_Q32(t)  ((uint32_t)(int32_t)(((t) - (int32_t)(t)) * 2147483648.0f) << 1)
+#define CZT_Q32_TURN(q)  ((int32_t)(q) * (1.0f / 4294967296.0f))
+static void czt_inverse(float array[][2], float work[][2], uint16_t n_in, uint16_t n_out, float f0, float df) {
+	uint16_t i;
+	float s, c, re, im;
+	uint32_t q_f0 = CZT_TURN_Q32(f0), q_df = CZT_TURN_Q32(0.5f * df);
+	// Chirp b[k] = exp(-j*pi*df*k^2), k = -(n_in-1)..(n_out-1), place as circular buffer
+	for (i = 0; i < FFT_SIZE; i++)
+		work[i][0] = work[i][1] = 0.0f;
+	for (i = 0; i < n_out || i < n_in; i++) {
+		vna_sin_cos(-CZT_Q32_TURN(q_df * ((uint32_t)i * i)), &s, &c);
+		if (i < n_out)     {work[i][0] = c;            work[i][1] = s;}
+		if (i && i < n_in) {work[FFT_SIZE - i][0] = c; work[FFT_SIZE - i][1] = s;}
+	}
+	fft_forward(work);
+	// a[n] = X[n] * exp(+j*2*pi*(f0*n + df*n^2/2))
+	for (i = 0; i < FFT_SIZE; i++) {
+		if (i >= n_in) {array[i][0] = array[i][1] = 0.0f; continue;}
+		vna_sin_cos(CZT_Q32_TURN(q_f0 * i + q_df * ((uint32_t)i * i)), &s, &c);
+		re = array[i][0]; im = array[i][1];
+		array[i][0] = re * c - im * s;
+		array[i][1] = re * s + im * c;
+	}
+	fft_forward(array);
+	for (i = 0; i < FFT_SIZE; i++) {
+		re = array[i][0]; im = array[i][1];
+		array[i][0] = re * work[i][0] - im * work[i][1];
+		array[i][1] = re * work[i][1] + im * work[i][0];
+	}
+	// Result FFT_SIZE * convolution
+	fft_inverse(array);
+	// x[m] = exp(+j*pi*df*m^2) * conv[m]
+	for (i = 0; i < n_out; i++) {
+		vna_sin_cos(CZT_Q32_TURN(q_df * ((uint32_t)i * i)), &s, &c);
+		re = array[i][0] * (1.0f / FFT_SIZE); im = array[i][1] * (1.0f / FFT_SIZE);
+		array[i][0] = re * c - im * s;
+		array[i][1] = re * s + im * c;
+	}
+}
@@ -27,32 +27,44 @@ uint16_t lastsaveid = 0;
 #if SAVEAREA_MAX >= 8
 #error "Increase checksum_ok type for save more cache slots"
 #endif
-// properties CRC check cache (max 8 slots)
+#if SAVEAREA_MAX < 1
+#error "properties_t not fit in save area, reduce POINTS_COUNT or use __USE_PACKED_CAL_DATA__"
+#endif
+// Check properties_t size used in SAVE_PROP_CONFIG_SIZE calculation
+typedef char properties_size_check[sizeof(properties_t) <= SAVE_PROP_SIZE ? 1 : -1];
+// properties CRC check cache (max 8 slots), checked and valid slots bit mask
+static uint8_t checksum_checked = 0;
 static uint8_t checksum_ok = 0;
 
 static int flash_wait_for_last_operation(void)
 {
-  while (FLASH->SR == FLASH_SR_BSY) {
+  // Wait only BSY flag (error flags can be set)
+  while (FLASH->SR & FLASH_SR_BSY) {
     //WWDG->CR = WWDG_CR_T;
   }
   return FLASH->SR;
 }
 
-static void flash_erase_page0(uint32_t page_address)
+// Note: code run from same flash bank, so CPU (and interrupts) stall on flash read while erase
+// or program, no sense run it in other thread, lock only register sequence
+static void flash_erase_page(uint32_t page_address)
 {
   flash_wait_for_last_operation();
+  chSysLock();
   FLASH->CR |= FLASH_CR_PER;
   FLASH->AR = page_address;
   FLASH->CR |= FLASH_CR_STRT;
+  chSysUnlock();
   flash_wait_for_last_operation();
   FLASH->CR &= ~FLASH_CR_PER;
 }
 
-static void flash_erase_page(uint32_t page_address)
+static bool flash_is_erased(const void *addr, uint32_t size)
 {
-  chSysLock();
-  flash_erase_page0(page_address);
-  chSysUnlock();
+  const uint32_t *p = (const uint32_t *)addr;
+  for (size/= sizeof(uint32_t); size; size--)
+    if (*p++ != 0xFFFFFFFF) return false;
+  return true;
 }
 
 static inline void flash_unlock(void)
@@ -62,29 +74,46 @@ static inline void flash_unlock(void)
   FLASH->KEYR = 0xCDEF89AB;
 }
 
-static void flash_program_half_word_buffer(uint16_t* dst, uint16_t *data, uint16_t size)
+// Program data to erased flash (no erase, flash should be unlocked)
+// F072 and F303 flash support only half word program, PG set once for all buffer
+// 0xFFFF values skipped (erased flash already have it)
+static void flash_program_half_word(uint16_t* dst, const uint16_t *data, uint16_t size)
 {
   uint32_t i;
-  flash_unlock();
-  // erase flash pages for buffer (aligned to FLASH_PAGESIZE)
-  for (i = 0; i < size; i+=FLASH_PAGESIZE)
-    flash_erase_page((uint32_t)dst + i);
-  // Save buffer
   __IO uint16_t* p = dst;
+  flash_wait_for_last_operation();
+  FLASH->CR |= FLASH_CR_PG;
   for (i = 0; i < size/sizeof(uint16_t); i++){
-    flash_wait_for_last_operation();
-    FLASH->CR |= FLASH_CR_PG;
+    if (data[i] == 0xFFFF) continue;
     p[i] = data[i];
     flash_wait_for_last_operation();
-    FLASH->CR &= ~FLASH_CR_PG;
   }
+  FLASH->CR &= ~FLASH_CR_PG;
 }
 
-static uint32_t
-checksum(const void *start, size_t len)
+static void flash_program_half_word_buffer(uint16_t* dst, uint16_t *data, uint16_t size)
+{
+  uint32_t i, len;
+  flash_unlock();
+  // write by flash pages (buffer aligned to FLASH_PAGESIZE)
+  for (i = 0; i < size; i+=len) {
+    len = size - i < FLASH_PAGESIZE ? size - i : FLASH_PAGESIZE;
+    uint8_t *page = (uint8_t *)dst + i;
+    // Page data not changed, not need erase and write
+    if (memcmp(page, (uint8_t *)data + i, len) == 0)
+      continue;
+    // erase only if need
+    if (!flash_is_erased(page, FLASH_PAGESIZE))
+      flash_erase_page((uint32_t)page);
+    flash_program_half_word((uint16_t *)page, (uint16_t *)((uint8_t *)data + i), len);
+  }
+}
+
+// Continue checksum from value (allow check data by blocks, block size should be aligned by 4)
+uint32_t
+checksum_update(uint32_t value, const void *start, size_t len)
 {
   uint32_t *p = (uint32_t*)start;
-  uint32_t value = 0;
   // align by sizeof(uint32_t)
   len = (len + sizeof(uint32_t)-1)/sizeof(uint32_t);
   while (len-- > 0)
@@ -92,30 +121,83 @@ checksum(const void *start, size_t len)
   return value;
 }
 
+static uint32_t
+checksum(const void *start, size_t len)
+{
+  return checksum_update(0, start, len);
+}
+
+// Config area used as journal: every save append config_t record after last used,
+// page erased only if full (wear and blocking erase reduced in CONFIG_JOURNAL_MAX times)
+// On recall used last valid record (broken on power loss record skipped)
+// Old single record at begin of area is valid journal with one record
+#define CONFIG_JOURNAL_MAX  (SAVE_CONFIG_SIZE / sizeof(config_t))
+// Check config_t size fit in SAVE_CONFIG_SIZE and aligned by 4 (records follow one by one)
+typedef char config_size_check[CONFIG_JOURNAL_MAX >= 1 && (sizeof(config_t) & 3) == 0 ? 1 : -1];
+
+static const config_t *
+config_journal_find(uint32_t *free)
+{
+  const config_t *src = (const config_t*)SAVE_CONFIG_ADDR;
+  const config_t *last = NULL;
+  uint32_t i;
+  for (i = 0; i < CONFIG_JOURNAL_MAX; i++, src++) {
+    // Records write in order, first erased is free
+    if (src->magic == 0xFFFFFFFF)
+      break;
+    if (src->magic == CONFIG_MAGIC && checksum(src, sizeof *src - sizeof src->checksum) == src->checksum)
+      last = src;
+  }
+  if (free) *free = i;
+  return last;
+}
+
 int
 config_save(void)
 {
+  uint32_t id;
+  const config_t *last = config_journal_find(&id);
   // Apply magic word and calculate checksum
   config.magic = CONFIG_MAGIC;
   config.checksum = checksum(&config, sizeof config - sizeof config.checksum);
+  // Not changed, not need write
+  if (last && memcmp(last, &config, sizeof(config_t)) == 0)
+    return 0;
 
-  // write to flash
-  flash_program_half_word_buffer((uint16_t*)SAVE_CONFIG_ADDR, (uint16_t*)&config, sizeof(config_t));
+  // write to flash, erase page only if journal full
+  flash_unlock();
+  if (id >= CONFIG_JOURNAL_MAX) {
+    uint32_t i;
+    for (i = 0; i < SAVE_CONFIG_SIZE; i+=FLASH_PAGESIZE)
+      flash_erase_page(SAVE_CONFIG_ADDR + i);
+    id = 0;
+  }
+  flash_program_half_word((uint16_t*)(SAVE_CONFIG_ADDR + id * sizeof(config_t)), (uint16_t*)&config, sizeof(config_t));
   return 0;
 }
 
 int
 config_recall(void)
 {
-  const config_t *src = (const config_t*)SAVE_CONFIG_ADDR;
+  const config_t *src = config_journal_find(NULL);
 
-  if (src->magic != CONFIG_MAGIC || checksum(src, sizeof *src - sizeof src->checksum) != src->checksum)
+  if (src == NULL)
     return -1;
   // duplicated saved data onto sram to be able to modify marker/trace
   memcpy(&config, src, sizeof(config_t));
   return 0;
 }
 
+// properties_t checksum (for save and check current_props)
+uint32_t
+caldata_checksum(void)
+{
+  return checksum(&current_props, sizeof current_props - sizeof current_props.checksum);
+}
+
+// Calibration slots not journaled (only config area use journal), slot save erase and write
+// own slot pages: active_props and caldata_get() use slots direct from flash (fixed address
+// need), and save area full used by config page + SAVEAREA_MAX slots (no free pages for log)
 int
 caldata_save(uint32_t id)
 {
@@ -124,7 +206,7 @@ caldata_save(uint32_t id)
 
   // Apply magic word and calculate checksum
   current_props.magic = CONFIG_MAGIC;
-  current_props.checksum = checksum(&current_props, sizeof current_props - sizeof current_props.checksum);
+  current_props.checksum = caldata_checksum();
 
   // write to flash
   uint16_t *dst = (uint16_t*)(SAVE_PROP_CONFIG_ADDR + id * SAVE_PROP_CONFIG_SIZE);
@@ -133,23 +215,42 @@ caldata_save(uint32_t id)
   // after saving data, make active configuration points to flash
   active_props = (properties_t*)(SAVE_PROP_CONFIG_ADDR + id * SAVE_PROP_CONFIG_SIZE);
   lastsaveid = id;
+  // recheck slot on next use
+  checksum_checked&=~(1<<id);
 
   return 0;
 }
 
+// Return slot on flash if valid, else NULL
+// Checksum calculated only 1 time for every slot (and after save), slot header
+// (magic, frequency range, points, cal status) can be used for slot info without recheck
+const properties_t *
+caldata_get(uint32_t id)
+{
+  if (id >= SAVEAREA_MAX)
+    return NULL;
+  const properties_t *src = (const properties_t*)(SAVE_PROP_CONFIG_ADDR + id * SAVE_PROP_CONFIG_SIZE);
+  uint8_t mask = 1<<id;
+  if (!(checksum_checked & mask)) {
+    checksum_checked|= mask;
+    if (src->magic == CONFIG_MAGIC && checksum(src, sizeof *src - sizeof src->checksum) == src->checksum)
+      checksum_ok|= mask;
+    else
+      checksum_ok&=~mask;
+  }
+  return (checksum_ok & mask) ? src : NULL;
+}
+
 int
 caldata_recall(uint32_t id)
 {
-  if (id >= SAVEAREA_MAX)
-    goto load_default;
   // point to saved area on the flash memory
-  properties_t *src = (properties_t*)(SAVE_PROP_CONFIG_ADDR + id * SAVE_PROP_CONFIG_SIZE);
-
-  if (src->magic != CONFIG_MAGIC || checksum(src, sizeof *src - sizeof src->checksum) != src->checksum)
+  const properties_t *src = caldata_get(id);
+  if (src == NULL)
     goto load_default;
 
   // active configuration points to save data on flash memory
-  active_props = src;
+  active_props = (properties_t *)src;
   lastsaveid = id;
 
   // duplicated saved data onto sram to be able to modify marker/trace
@@ -161,21 +262,47 @@ load_default:
 }
 
 // Used in interpolate
+// Select saved calibration slot best for sweep range, return NO_SAVE_SLOT if not found
+// Slot covering all range with minimal frequency step first, else slot with max range overlap
+// On equal score leave lastsaveid
+uint16_t
+caldata_select(uint32_t start, uint32_t stop)
+{
+  uint16_t id, best = NO_SAVE_SLOT;
+  bool best_cover = false;
+  uint32_t best_overlap = 0, best_step = 0;
+  for (id = 0; id < SAVEAREA_MAX; id++) {
+    const properties_t *p = caldata_get(id);
+    if (p == NULL || !(p->_cal_status & CALSTAT_APPLY) || p->_sweep_points < 2)
+      continue;
+    uint32_t f0 = p->_frequency0 > start ? p->_frequency0 : start;
+    uint32_t f1 = p->_frequency1 < stop  ? p->_frequency1 : stop;
+    if (f0 > f1) continue; // not overlap
+    bool cover = p->_frequency0 <= start && stop <= p->_frequency1;
+    uint32_t overlap = f1 - f0;
+    uint32_t step = (p->_frequency1 - p->_frequency0) / (p->_sweep_points - 1);
+    if (best != NO_SAVE_SLOT) {
+      if (best_cover != cover) {
+        if (best_cover) continue;
+      }
+      else if (!cover && overlap != best_overlap) {
+        if (overlap < best_overlap) continue;
+      }
+      else if (step > best_step || (step == best_step && id != lastsaveid))
+        continue;
+    }
+    best = id;
+    best_cover = cover;
+    best_overlap = overlap;
+    best_step = step;
+  }
+  return best;
+}
+
 const properties_t *
 caldata_reference(void)
 {
-  if (lastsaveid >= SAVEAREA_MAX)
-    return NULL;
-  const properties_t *src;
-
-  src = (const properties_t*)(SAVE_PROP_CONFIG_ADDR + lastsaveid * SAVE_PROP_CONFIG_SIZE);
-  // Check crc cache mask (made it only 1 time)
-  if (checksum_ok&(1<<lastsaveid))
-    return src;
-  if (src->magic != CONFIG_MAGIC || checksum(src, sizeof *src - sizeof src->checksum) != src->checksum)
-    return NULL;
-  checksum_ok|=1<<lastsaveid;
-  return src;
+  return caldata_get(lastsaveid);
 }
 
 void
@@ -183,9 +310,11 @@ clear_all_config_prop_data(void)
 {
   uint32_t i;
   flash_unlock();
+  checksum_checked = 0;
 
   // erase flash pages
   for (i = 0; i < SAVE_FULL_AREA_SIZE; i+=FLASH_PAGESIZE)
-    flash_erase_page(SAVE_CONFIG_ADDR + i);
+    if (!flash_is_erased((void *)(SAVE_CONFIG_ADDR + i), FLASH_PAGESIZE))
+      flash_erase_page(SAVE_CONFIG_ADDR + i);
 }
 
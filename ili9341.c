@@ -23,10 +23,21 @@
 #include "nanovna.h"
 
 #include "spi.h"
+#include <string.h>
 // Allow enable DMA for read display data
 //#define __USE_DISPLAY_DMA_RX__
 //#undef __USE_DISPLAY_DMA__
 
+// SD card sector data Rx use DMA (SD card and LCD share SPI1 bus, need Rx DMA stream)
+#if defined(__USE_SD_CARD__) && defined(__USE_DISPLAY_DMA__)
+#define __USE_SDCARD_DMA_RX__
+#endif
+
+// Allocate SPI Rx DMA stream if LCD or SD card use it
+#if defined(__USE_DISPLAY_DMA_RX__) || defined(__USE_SDCARD_DMA_RX__)
+#define __USE_SPI_DMA_RX__
+#endif
+
 // Pin macros for LCD
 #define LCD_CS_LOW        palClearPad(GPIOB, GPIOB_LCD_CS)
 #define LCD_CS_HIGH       palSetPad(GPIOB, GPIOB_LCD_CS)
@@ -172,7 +183,7 @@ static void spi_lld_serve_tx_interrupt(SPIDriver *spip, uint32_t flags)
 }
 #endif
 
-#ifdef __USE_DISPLAY_DMA_RX__
+#ifdef __USE_SPI_DMA_RX__
 static const stm32_dma_stream_t  *dmarx = STM32_DMA_STREAM(STM32_SPI_SPI1_RX_DMA_STREAM);
 static const uint32_t rxdmamode =
     STM32_DMA_CR_CHSEL(SPI1_RX_DMA_CHANNEL)         // Select SPI1 Rx DMA
@@ -246,15 +257,15 @@ void spi_DropRx(void){
 }
 
 #ifdef __USE_DISPLAY_DMA__
-// SPI receive byte buffer use DMA
+// SPI transmit byte buffer use DMA
 void spi_DMATxBuffer(uint8_t *buffer, uint16_t len) {
   dmaStreamSetMemory0(dmatx, buffer);
   dmaStreamSetMode(dmatx, txdmamode | STM32_DMA_CR_PSIZE_BYTE | STM32_DMA_CR_MSIZE_BYTE | STM32_DMA_CR_MINC);
   dmaStreamFlush(len);
 }
 
-#ifdef __USE_DISPLAY_DMA_RX__
-// SPI transmit byte buffer use DMA
+#ifdef __USE_SPI_DMA_RX__
+// SPI receive byte buffer use DMA (full duplex, Tx DMA send dummy 0xFF for rx clock)
 static void spi_DMARxBuffer(uint8_t *buffer, uint16_t len) {
   uint8_t dummy_tx = 0xFF;
   // Init Rx DMA buffer, size, mode (spi and mem data size is 8 bit)
@@ -298,7 +309,7 @@ static void spi_init(void)
   dmaStreamAllocate(dmatx, STM32_SPI_SPI1_IRQ_PRIORITY, NULL, NULL);
   dmaStreamSetPeripheral(dmatx, &LCD_SPI->DR);
   LCD_SPI->CR2|= SPI_CR2_TXDMAEN;    // Tx DMA enable
-#ifdef __USE_DISPLAY_DMA_RX__
+#ifdef __USE_SPI_DMA_RX__
   // Rx DMA init
   dmaStreamAllocate(dmarx, STM32_SPI_SPI1_IRQ_PRIORITY, NULL, NULL);
   dmaStreamSetPeripheral(dmarx, &LCD_SPI->DR);
@@ -489,13 +500,58 @@ pixel_t *ili9341_get_cell_buffer(void){
 #if DISPLAY_CELL_BUFFER_COUNT == 1
   return spi_buffer;
 #else
-  return &spi_buffer[(LCD_dma_status&LCD_BUFFER_1) ? SPI_BUFFER_SIZE/2 : 0];
+  return &spi_buffer[(LCD_dma_status&LCD_BUFFER_1) ? CELLWIDTH*CELLHEIGHT : 0];
 #endif
 }
 
+// Screen render target (screenshot without LCD read), if set LCD fill and bulk output go to
+// buffer rows render_y ... render_y + render_h - 1 (LCD_WIDTH pixels per row), not to LCD
+static pixel_t *render_buf = NULL;
+static int16_t  render_y, render_h;
+
+void ili9341_set_render_target(pixel_t *buf, int y, int h)
+{
+  render_buf = buf;
+  render_y = y;
+  render_h = h;
+}
+
+// Copy region data (or fill by color if src = NULL) to render buffer, clipped by buffer rows
+static void render_region(int x, int y, int w, int h, const pixel_t *src, pixel_t color)
+{
+  int i, j;
+  int y0 = y < render_y ? render_y : y;
+  int y1 = y + h > render_y + render_h ? render_y + render_h : y + h;
+  int x0 = x < 0 ? 0 : x;
+  int x1 = x + w > LCD_WIDTH ? LCD_WIDTH : x + w;
+  for (j = y0; j < y1; j++) {
+    pixel_t *dst = &render_buf[(j - render_y) * LCD_WIDTH];
+    if (src == NULL)
+      for (i = x0; i < x1; i++) dst[i] = color;
+    else
+      for (i = x0; i < x1; i++) dst[i] = src[(j - y) * w + i - x];
+  }
+}
+
+// Draw bitmap direct to render buffer rows (spi_buffer not used), clipped by buffer rows
+static void render_bitmap(int x, int y, int w, int h, const uint8_t *b)
+{
+  int r, c;
+  int stride = (w + 7) / 8;
+  for (c = 0; c < h; c++, b+= stride) {
+    int j = y + c - render_y;
+    if (j < 0 || j >= render_h)
+      continue;
+    for (r = 0; r < w; r++)
+      if (x + r >= 0 && x + r < LCD_WIDTH)
+        render_buf[j * LCD_WIDTH + x + r] = (b[r>>3] & (0x80>>(r&7))) ? foreground_color : background_color;
+  }
+}
+
 #ifndef __USE_DISPLAY_DMA__
 void ili9341_fill(int x, int y, int w, int h, pixel_t color)
 {
+  if (render_buf) {render_region(x, y, w, h, NULL, color); return;}
   ili9341_setWindow(x, y ,w, h);
   ili9341_send_command(ILI9341_MEMORY_WRITE, 0, NULL);
   uint32_t len = w * h;
@@ -512,6 +568,7 @@ void ili9341_fill(int x, int y, int w, int h, pixel_t color)
 
 void ili9341_bulk(int x, int y, int w, int h)
 {
+  if (render_buf) {render_region(x, y, w, h, spi_buffer, 0); return;}
   ili9341_setWindow(x, y ,w, h);
   ili9341_send_command(ILI9341_MEMORY_WRITE, 0, NULL);
   spi_TxBuffer((uint8_t *)spi_buffer, w * h * sizeof(pixel_t));
@@ -532,6 +589,7 @@ void ili9341_bulk_finish(void){
 // Fill region by some color
 void ili9341_fill(int x, int y, int w, int h)
 {
+  if (render_buf) {render_region(x, y, w, h, NULL, background_color); return;}
   ili9341_setWindow(x, y ,w, h);
   ili9341_send_command(ILI9341_MEMORY_WRITE, 0, NULL);
   dmaStreamSetMemory0(dmatx, &background_color);
@@ -565,6 +623,7 @@ static void ili9341_DMA_bulk(int x, int y, int w, int h, pixel_t *buffer){
 // Copy spi_buffer to region, wait completion after
 void ili9341_bulk(int x, int y, int w, int h)
 {
+  if (render_buf) {render_region(x, y, w, h, spi_buffer, 0); return;}
   ili9341_DMA_bulk(x, y ,w, h, spi_buffer);  // Send data
   ili9341_bulk_finish();                     // Wait
 }
@@ -575,6 +634,7 @@ void ili9341_bulk_continue(int x, int y, int w, int h)
 #if DISPLAY_CELL_BUFFER_COUNT == 1
   ili9341_bulk(x, y, w, h);
 #else
+  if (render_buf) {render_region(x, y, w, h, ili9341_get_cell_buffer(), 0); return;}
   ili9341_bulk_finish();                                    // Wait DMA
   ili9341_DMA_bulk(x, y , w, h, ili9341_get_cell_buffer()); // Send new cell data
   LCD_dma_status^=LCD_BUFFER_1;                             // Switch buffer
@@ -620,6 +680,236 @@ void ili9341_read_memory(int x, int y, int w, int h, uint16_t *out)
   }
 }
 
+//*****************************************************************************
+// LCD screenshot BMP encoder (used for SD card and capture)
+// Raw 16bpp RGB565 (lossless), or RLE8 compressed with LCD palette, RLE8 can be
+// used only if all screen pixels is palette colors (lcd_screenshot_palette_only)
+// Screen rows read from LCD, or rendered (render_screen_rows) without LCD read
+//*****************************************************************************
+// Rows read from LCD (or rendered) at one time
+#define BMP_READ_ROWS      2
+#if LCD_HEIGHT % BMP_READ_ROWS || CELLHEIGHT % BMP_READ_ROWS
+#error "LCD_HEIGHT and CELLHEIGHT should be multiple of BMP_READ_ROWS"
+#endif
+// Read need 3 bytes per pixel, encoded rows placed after index data (max 2*w + 2 bytes per row)
+#if (SPI_BUFFER_SIZE*LCD_PIXEL_SIZE) < (BMP_READ_ROWS*LCD_WIDTH*3 + BMP_READ_ROWS*2 + 2)
+#error "Low size of spi_buffer for BMP screenshot"
+#endif
+// Rendered rows placed after render scratch, scratch used only by plot cell render: draw_cell clip
+// all cell drawing by rendered rows, so write only CELLWIDTH * BMP_READ_ROWS pixels of cell buffer
+// (text and bitmaps drawn direct to render rows, spi_buffer not used). Used spi_buffer size =
+// 2 * (BMP_RENDER_OFFSET + BMP_READ_ROWS*LCD_WIDTH) + BMP_READ_ROWS*(2*LCD_WIDTH+2) + 2
+// (2438 bytes, FatFs objects placed at the end of spi_buffer not overwritten)
+#define BMP_RENDER_OFFSET  256
+#if BMP_RENDER_OFFSET < CELLWIDTH * BMP_READ_ROWS || DISPLAY_CELL_BUFFER_COUNT != 1
+#error "Cell rows render buffer overlap screen rows render buffer"
+#endif
+// Color not found in palette
+#define BMP_NO_INDEX       0xFF
+
+#define BMP_UINT32(val)  ((val)>>0)&0xFF, ((val)>>8)&0xFF, ((val)>>16)&0xFF, ((val)>>24)&0xFF
+#define BMP_H1_SIZE      (14)                        // BMP header 14 bytes
+#define BMP_V4_SIZE      (56)                        // v4  header 56 bytes
+#define BMP_HEAD_SIZE    (BMP_H1_SIZE + BMP_V4_SIZE) // Size of all headers
+#define BMP_SIZE         (2*LCD_WIDTH*LCD_HEIGHT)    // Bitmap size = 2*w*h
+#define BMP_FILE_SIZE    (BMP_SIZE + BMP_HEAD_SIZE)  // File size = headers + bitmap
+// Bitmap file header for LCD_WIDTH x LCD_HEIGHT image 16bpp (v4 format allow set RGB mask)
+static const uint8_t bmp_header_v4[14+56] = {
+// BITMAPFILEHEADER (14 byte size)
+  0x42, 0x4D,                // BM signature
+  BMP_UINT32(BMP_FILE_SIZE), // File size (h + v4 + bitmap)
+  0x00, 0x00,                // reserved
+  0x00, 0x00,                // reserved
+  BMP_UINT32(BMP_HEAD_SIZE), // Size of all headers (h + v4)
+// BITMAPINFOv4 (56 byte size)
+  BMP_UINT32(BMP_V4_SIZE),   // Data offset after this point (v4 size)
+  BMP_UINT32(LCD_WIDTH),     // Width
+  BMP_UINT32(LCD_HEIGHT),    // Height
+  0x01, 0x00,                // Planes
+  0x10, 0x00,                // 16bpp
+  0x03, 0x00, 0x00, 0x00,    // Compression (BI_BITFIELDS)
+  BMP_UINT32(BMP_SIZE),      // Bitmap size (w*h*2)
+  0xC4, 0x0E, 0x00, 0x00,    // x Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
+  0xC4, 0x0E, 0x00, 0x00,    // y Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
+  0x00, 0x00, 0x00, 0x00,    // Palette size
+  0x00, 0x00, 0x00, 0x00,    // Palette used
+// Extend v4 header data (color mask for RGB565)
+  0x00, 0xF8, 0x00, 0x00,    // R mask = 0b11111000 00000000
+  0xE0, 0x07, 0x00, 0x00,    // G mask = 0b00000111 11100000
+  0x1F, 0x00, 0x00, 0x00,    // B mask = 0b00000000 00011111
+  0x00, 0x00, 0x00, 0x00     // A mask = 0b00000000 00000000
+};
+
+// Bitmap file header for RLE8 compressed image, palette = LCD palette
+static const uint8_t bmp_rle8_header[14+40] = {
+// BITMAPFILEHEADER (14 byte size)
+  0x42, 0x4D,                // BM signature
+  BMP_UINT32(0),             // File size (set after encode, BMP_FILE_SIZE_OFFSET)
+  0x00, 0x00,                // reserved
+  0x00, 0x00,                // reserved
+  BMP_UINT32(BMP_RLE8_DATA_OFFSET), // Size of all headers and palette
+// BITMAPINFOHEADER (40 byte size)
+  BMP_UINT32(40),            // Header size
+  BMP_UINT32(LCD_WIDTH),     // Width
+  BMP_UINT32(LCD_HEIGHT),    // Height
+  0x01, 0x00,                // Planes
+  0x08, 0x00,                // 8bpp
+  0x01, 0x00, 0x00, 0x00,    // Compression (BI_RLE8)
+  BMP_UINT32(0),             // Bitmap size (set after encode, BMP_IMAGE_SIZE_OFFSET)
+  0xC4, 0x0E, 0x00, 0x00,    // x Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
+  0xC4, 0x0E, 0x00, 0x00,    // y Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
+  BMP_UINT32(BMP_RLE8_PALETTE), // Palette size
+  0x00, 0x00, 0x00, 0x00,    // Palette used
+};
+
+// Get palette index for color
+static uint8_t bmp_color_index(pixel_t color)
+{
+  int i;
+  for (i = 0; i < MAX_PALETTE; i++)
+    if (config.lcd_palette[i] == color)
+      return i;
+  return BMP_NO_INDEX;
+}
+
+// Palette entry in BMP format (B, G, R, 0)
+static void bmp_palette_entry(uint8_t *p, uint32_t i)
+{
+  uint16_t c = __REVSH(config.lcd_palette[i]);
+  p[0] = (c << 3)&0xF8;
+  p[1] = (c >> 3)&0xFC;
+  p[2] = (c >> 8)&0xF8;
+  p[3] = 0;
+}
+
+// Encode row of palette indexes, return encoded size (max 2*w + 2 bytes)
+static uint16_t bmp_rle8_row(uint8_t *out, const uint8_t *idx, int w)
+{
+  uint8_t *p = out;
+  int i = 0, n;
+  while (i < w) {
+    // Count repeated pixels
+    for (n = 1; i + n < w && n < 255 && idx[i + n] == idx[i]; n++)
+      ;
+    if (n == 1) {
+      // Count not repeated pixels, use absolute mode if more 2
+      for (; i + n < w && n < 255 && (i + n + 1 >= w || idx[i + n] != idx[i + n + 1]); n++)
+        ;
+      if (n > 2) {
+        *p++ = 0;
+        *p++ = n;
+        memcpy(p, &idx[i], n); p+= n;
+        if (n & 1) *p++ = 0; // align to word
+        i+= n;
+        continue;
+      }
+      n = 1;
+    }
+    *p++ = n;
+    *p++ = idx[i];
+    i+= n;
+  }
+  // End of line
+  *p++ = 0;
+  *p++ = 0;
+  return p - out;
+}
+
+// Convert colors to palette index in place (index size less then color), return false if color not in palette
+static bool bmp_rows_to_index(uint8_t *idx, const pixel_t *buf, int len)
+{
+  int i;
+  pixel_t color = buf[0];
+  uint8_t c_idx = bmp_color_index(color);
+  for (i = 0; i < len; i++) {
+    if (buf[i] != color) {color = buf[i]; c_idx = bmp_color_index(color);}
+    if (c_idx == BMP_NO_INDEX)
+      return false;
+    idx[i] = c_idx;
+  }
+  return true;
+}
+
+// Get BMP_READ_ROWS screen rows from y, read from LCD or render
+static pixel_t *bmp_get_rows(int y, bool render)
+{
+  pixel_t *buf = spi_buffer;
+  if (render) {
+    buf = &spi_buffer[BMP_RENDER_OFFSET];
+    render_screen_rows(y, BMP_READ_ROWS, buf);
+  }
+  else
+    ili9341_read_memory(0, y, LCD_WIDTH, BMP_READ_ROWS, buf);
+  return buf;
+}
+
+// Check all screen pixels is LCD palette colors (RLE8 BMP possible without lost colors)
+// Rendered screen use only palette colors (all draw colors set by palette index), so check only LCD
+bool lcd_screenshot_palette_only(void)
+{
+  int y;
+  for (y = 0; y < LCD_HEIGHT; y+= BMP_READ_ROWS) {
+    pixel_t *buf = bmp_get_rows(y, false);
+    if (!bmp_rows_to_index((uint8_t *)buf, buf, BMP_READ_ROWS * LCD_WIDTH))
+      return false;
+  }
+  return true;
+}
+
+// Screenshot, read LCD (or render screen) and send BMP file data to out function (use spi_buffer)
+// rle8 = false: raw 16bpp file (headers complete)
+// rle8 = true:  RLE8 compressed file (file and image size in header need set after), all pixels
+//               should be palette colors (check lcd_screenshot_palette_only before for LCD read)
+// Return BMP file size, 0 on error
+uint32_t lcd_screenshot_bmp(bool (*out)(const void *data, uint16_t size), bool rle8, bool render)
+{
+  int y, i;
+  uint16_t size;
+  uint32_t total;
+  if (!rle8) {
+    if (!out(bmp_header_v4, sizeof(bmp_header_v4)))
+      return 0;
+    // BMP rows stored from bottom to top
+    for (y = LCD_HEIGHT - BMP_READ_ROWS; y >= 0; y-= BMP_READ_ROWS) {
+      pixel_t *buf = bmp_get_rows(y, render);
+      for (i = 0; i < BMP_READ_ROWS * LCD_WIDTH; i++)
+        buf[i] = __REVSH(buf[i]); // swap byte order (example 0x10FF to 0xFF10)
+      for (i = BMP_READ_ROWS - 1; i >= 0; i--)
+        if (!out(&buf[i * LCD_WIDTH], LCD_WIDTH * sizeof(pixel_t)))
+          return 0;
+    }
+    return BMP_FILE_SIZE;
+  }
+  if (!out(bmp_rle8_header, sizeof(bmp_rle8_header)))
+    return 0;
+  uint8_t *pal = (uint8_t *)spi_buffer;
+  for (i = 0; i < BMP_RLE8_PALETTE; i++)
+    bmp_palette_entry(&pal[i*4], i);
+  if (!out(pal, BMP_RLE8_PALETTE*4))
+    return 0;
+  total = BMP_RLE8_DATA_OFFSET;
+  // BMP rows stored from bottom to top
+  for (y = LCD_HEIGHT - BMP_READ_ROWS; y >= 0; y-= BMP_READ_ROWS) {
+    pixel_t *buf = bmp_get_rows(y, render);
+    // Convert to index in place, encoded rows placed after index data
+    uint8_t *idx = (uint8_t *)buf;
+    uint8_t *rle = &idx[BMP_READ_ROWS * LCD_WIDTH];
+    if (!bmp_rows_to_index(idx, buf, BMP_READ_ROWS * LCD_WIDTH))
+      return 0;
+    for (size = 0, i = BMP_READ_ROWS - 1; i >= 0; i--)
+      size+= bmp_rle8_row(&rle[size], &idx[i * LCD_WIDTH], LCD_WIDTH);
+    if (y == 0) {
+      // End of bitmap
+      rle[size++] = 0;
+      rle[size++] = 1;
+    }
+    if (!out(rle, size))
+      return 0;
+    total+= size;
+  }
+  return total;
+}
+
 void ili9341_clear_screen(void)
 {
   ili9341_fill(0, 0, ILI9341_WIDTH, ILI9341_HEIGHT);
@@ -645,6 +935,7 @@ void ili9341_set_rotation(uint8_t r)
 //static uint8_t bit_align = 0;
 void ili9341_blitBitmap(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *b)
 {
+  if (render_buf) {render_bitmap(x, y, width, height, b); return;}
   pixel_t *buf = spi_buffer;
   uint8_t bits = 0;
   for (uint16_t c = 0; c < height; c++) {
@@ -977,11 +1268,7 @@ void ili9341_test(int mode)
 #define __USE_SDCARD_DMA__
 #endif
 
-// Use DMA on sector data Rx from SD card (only if enabled Rx DMA for LCD)
-#ifdef __USE_DISPLAY_DMA_RX__
-#define __USE_SDCARD_DMA_RX__
-#endif
-
+// Use DMA on sector data Rx from SD card (defined on top, Rx DMA stream allocated in spi_init)
 // Define sector size
 #define SD_SECTOR_SIZE      512
 // SD card spi bus
@@ -1024,8 +1311,11 @@ void testLog(void){
 #define SD_CS_LOW     palClearPad(GPIOB, GPIOB_SD_CS)
 #define SD_CS_HIGH    palSetPad(GPIOB, GPIOB_SD_CS)
 
+// SD card and LCD share SPI1 bus, before take it need wait LCD cell DMA flush complete
 static void SD_Select_SPI(uint32_t speed) {
+  ili9341_bulk_finish();     // Wait LCD transfer complete
   LCD_CS_HIGH;               // Unselect LCD
+  spi_DropRx();              // Drop LCD data from Rx FIFO
   SPI_BR_SET(SD_SPI, speed); // Set Baud rate control for SD card
   SD_CS_LOW;                 // Select SD Card
 }
@@ -1154,7 +1444,7 @@ static bool SD_RxDataBlock(uint8_t *buff, uint16_t len, uint8_t token) {
     DEBUG_PRINT(" rx SD_WaitDataToken err\r\n");
     return FALSE;
   }
-  // Receive data (Not use rx DMA)
+  // Receive data (use rx DMA if enabled)
 #ifdef __USE_SDCARD_DMA_RX__
   spi_DMARxBuffer(buff, len);
 #else
@@ -1259,6 +1549,7 @@ static uint8_t SD_SendCmd(uint8_t cmd, uint32_t arg) {
 // Power on SD
 static void SD_PowerOn(void) {
   uint16_t n;
+  ili9341_bulk_finish();
   LCD_CS_HIGH;
   // Dummy TxRx 80 bits for power up SD
   for (n=0;n<10;n++)
@@ -215,14 +215,14 @@ static void cell_draw_lc_match(int x0, int y0)
   ili9341_set_background(LCD_BG_COLOR);
   ili9341_set_foreground(LCD_LC_MATCH_COLOR);
 
-  if (yp > -FONT_GET_HEIGHT && yp < CELLHEIGHT)
+  if (yp > -FONT_GET_HEIGHT && yp < cell_height)
   {
      plot_printf(s, sizeof(s), "L/C match for source Z0 = %0.1f"S_OHM, lc_match_array.R0);
      cell_drawstring(s, xp, yp);
   }
 #if 0
   yp += STR_LC_MATH_HEIGHT;
-  if (yp > -FONT_GET_HEIGHT && yp < CELLHEIGHT)
+  if (yp > -FONT_GET_HEIGHT && yp < cell_height)
   {
      plot_printf(s, sizeof(s), "%qHz %0.1f %c j%0.1f"S_OHM, match_array->Hz, match_array->RL, (match_array->XL >= 0) ? '+' : '-', fabsf(match_array->XL));
      cell_drawstring(s, xp, yp);
@@ -230,7 +230,7 @@ static void cell_draw_lc_match(int x0, int y0)
 #endif
 
   yp += STR_LC_MATH_HEIGHT;
-  if (yp >= CELLHEIGHT) return;
+  if (yp >= cell_height) return;
   if (lc_match_array.num_matches < 0)
     cell_drawstring("No LC match for this", xp, yp);
   else if (lc_match_array.num_matches == 0)
@@ -241,7 +241,7 @@ static void cell_draw_lc_match(int x0, int y0)
     cell_drawstring("Load shunt", xp + 2*STR_LC_MATH_WIDTH, yp);
     for (int i = 0; i < lc_match_array.num_matches; i++){
       yp += STR_LC_MATH_HEIGHT;
-      if (yp >= CELLHEIGHT) return;
+      if (yp >= cell_height) return;
       if (yp > -FONT_GET_HEIGHT){
         lc_match_x_str(lc_match_array.Hz, lc_match_array.matches[i].xps, xp                      , yp);
         lc_match_x_str(lc_match_array.Hz, lc_match_array.matches[i].xs , xp +   STR_LC_MATH_WIDTH, yp);
@@ -76,6 +76,8 @@ static volatile vna_shellcmd_t  shell_function = 0;
 //#define ENABLE_I2C_COMMAND
 // Enable LCD command for send data to LCD screen, used for debug
 //#define ENABLE_LCD_COMMAND
+// Enable frametime command, measure full screen redraw time (for compare cell buffer count)
+//#define ENABLE_FRAME_TIME_COMMAND
 // Enable output debug data on screen on hard fault
 //#define ENABLE_HARD_FAULT_HANDLER_DEBUG
 // Enable test command, used for debug
@@ -109,11 +111,14 @@ static void apply_edelay(void);
 
 static uint16_t get_sweep_mask(void);
 static void cal_interpolate(void);
-static void update_frequencies(bool interpolate);
+static void cal_auto_select(void);
 static int  set_frequency(uint32_t freq);
 static void set_frequencies(uint32_t start, uint32_t stop, uint16_t points);
 static bool sweep(bool break_on_operation, uint16_t ch_mask);
 static void transform_domain(void);
+#ifdef __USE_TD_GATE__
+static void gate_domain(void);
+#endif
 
 uint8_t sweep_mode = SWEEP_ENABLE;
 uint8_t redraw_request = 0; // contains REDRAW_XXX flags
@@ -126,6 +131,8 @@ static uint16_t p_sweep = 0;
 static int16_t rx_buffer[AUDIO_BUFFER_LEN * 2];
 // Sweep measured data
 float measured[2][POINTS_COUNT][2];
+// Measured data version by channel (changed on data update, used for trace index cache)
+uint16_t measured_version[2];
 uint32_t frequencies[POINTS_COUNT];
 
 #undef VERSION
@@ -192,6 +199,9 @@ static THD_FUNCTION(Thread1, arg)
     // Process collected data, calculate trace coordinates and plot only if scan completed
     if ((sweep_mode & SWEEP_ENABLE) && completed) {
       if (electrical_delay != 0) apply_edelay();
+#ifdef __USE_TD_GATE__
+      if (TD_GATE_ENABLED()) gate_domain();
+#endif
       if ((domain_mode & DOMAIN_MODE) == DOMAIN_TIME) transform_domain();
 
       // Prepare draw graphics, cache all lines, mark screen cells for redraw
@@ -248,15 +258,47 @@ kaiser_window(float k, float n, float beta)
   return bessel0(beta * sqrt(1 - r * r)) / bessel0(beta);
 }
 
+// Window value for k point of n size window
+static float
+td_window(float k, float n)
+{
+  float s, c, w;
+  switch (domain_mode & TD_WINDOW) {
+    case TD_WINDOW_MINIMUM:  return 1.0f; // this is rectangular
+    case TD_WINDOW_NORMAL:   return kaiser_window(k, n, 6.0f);
+    case TD_WINDOW_MAXIMUM:  return kaiser_window(k, n, 13.0f);
+    case TD_WINDOW_HANN:
+      vna_sin_cos(k / (n - 1), &s, &c);
+      return 0.5f - 0.5f * c;
+    case TD_WINDOW_BLACKMAN:
+      vna_sin_cos(k / (n - 1), &s, &c);
+      // cos(2x) = 2 * cos(x)^2 - 1
+      w = 0.42f - 0.5f * c + 0.08f * (2.0f * c * c - 1.0f);
+      return w > 0.0f ? w : 0.0f;
+  }
+  return 1.0f;
+}
+
 static void
 transform_domain(void)
 {
   // use spi_buffer as temporary buffer and calculate ifft for time domain
-  // Need 2 * sizeof(float) * FFT_SIZE bytes for work
+  // Need 2 * sizeof(float) * FFT_SIZE bytes for work (low pass use only half: real result ifft)
 #if 2*4*FFT_SIZE > (SPI_BUFFER_SIZE * LCD_PIXEL_SIZE)
 #error "Need increase spi_buffer or use less FFT_SIZE value"
 #endif
   float* tmp = (float*)spi_buffer;
+#ifdef __USE_TD_ZOOM__
+  // Chirp-Z use second FFT_SIZE buffer
+#if 4*4*FFT_SIZE > (SPI_BUFFER_SIZE * LCD_PIXEL_SIZE)
+#error "Need increase spi_buffer or disable __USE_TD_ZOOM__"
+#endif
+  bool zoom = TD_ZOOM_ENABLED();
+  // Zoom window in turns per point: (time * frequency step)
+  float fstep = frequencies[1] - frequencies[0];
+  float z_start = td_zoom_start * fstep;
+  float z_step  = (td_zoom_stop - td_zoom_start) * fstep / (sweep_points - 1);
+#endif
 
   uint16_t window_size = sweep_points, offset = 0;
   uint8_t is_lowpass = FALSE;
@@ -274,64 +316,78 @@ transform_domain(void)
       break;
   }
 
-  float beta = 0.0f;
-  switch (domain_mode & TD_WINDOW) {
-    case TD_WINDOW_MINIMUM:
-//    beta = 0.0f;  // this is rectangular
-      break;
-    case TD_WINDOW_NORMAL:
-      beta = 6.0f;
-      break;
-    case TD_WINDOW_MAXIMUM:
-      beta = 13.0f;
-      break;
-  }
-
-#if 1
-  // recalculate the scale factor if any window details are changed.
-  // the scale factor is to compensate for windowing.
+  // recalculate window table and scale factor only if any window details are changed.
+  // window stored as 16 bit 0..1 value (save RAM), the scale factor is to compensate for windowing.
+  // Without __USE_TD_WINDOW_TABLE__ window calculated on every use (only scale factor cached)
+#ifdef __USE_TD_WINDOW_TABLE__
+  static uint16_t window_table[POINTS_COUNT];
+#endif
   static float window_scale = 1.0f;
-  static uint16_t td_cache = 0;
-  uint16_t td_check = (domain_mode & (TD_WINDOW|TD_FUNC))|(sweep_points<<5);
+  static uint32_t td_cache = 0;
+  uint32_t td_check = (domain_mode & (TD_WINDOW|TD_FUNC))|(sweep_points<<8);
   if (td_cache!=td_check){
     td_cache=td_check;
+    window_scale = 0.0f;
+    for (int i = 0; i < sweep_points; i++) {
+      float w = td_window(i + offset, window_size);
+#ifdef __USE_TD_WINDOW_TABLE__
+      window_table[i] = w * 65535.0f + 0.5f;
+#endif
+      window_scale += w;
+    }
     if (td_func == TD_FUNC_LOWPASS_STEP)
       window_scale = 1.0f;
     else {
-      window_scale = 0.0f;
-      for (int i = 0; i < sweep_points; i++)
-        window_scale += kaiser_window(i + offset, window_size, beta);
       window_scale = (FFT_SIZE/2) / window_scale;
       if (td_func == TD_FUNC_BANDPASS)
         window_scale *= 2;
     }
-  }
-#else
-  // Disable compensation
-  #define window_scale 1
+#ifdef __USE_TD_WINDOW_TABLE__
+    window_scale/= 65535.0f;
 #endif
+  }
 
   uint16_t ch_mask = get_sweep_mask();
   for (int ch = 0; ch < 2; ch++,ch_mask>>=1) {
     if ((ch_mask&1)==0) continue;
     memcpy(tmp, measured[ch], sizeof(measured[0]));
     for (int i = 0; i < sweep_points; i++) {
-      float w = kaiser_window(i + offset, window_size, beta) * window_scale;
+#ifdef __USE_TD_WINDOW_TABLE__
+      float w = window_table[i] * window_scale;
+#else
+      float w = td_window(i + offset, window_size) * window_scale;
+#endif
       tmp[i * 2 + 0] *= w;
       tmp[i * 2 + 1] *= w;
     }
-    for (int i = sweep_points; i < FFT_SIZE; i++) {
-      tmp[i * 2 + 0] = 0.0;
-      tmp[i * 2 + 1] = 0.0;
+#ifdef __USE_TD_ZOOM__
+    if (zoom) {
+      // Low pass: conjugate mirror part give same real result, so use X[n] * 2 for n > 0
+      if (is_lowpass)
+        for (int i = 2; i < sweep_points * 2; i++)
+          tmp[i] *= 2.0f;
+      czt_inverse((float(*)[2])tmp, (float(*)[2])&tmp[2 * FFT_SIZE], sweep_points, sweep_points, z_start, z_step);
     }
+    else
+#endif
     if (is_lowpass) {
-      for (int i = 1; i < sweep_points; i++) {
-        tmp[(FFT_SIZE - i) * 2 + 0] = tmp[i * 2 + 0];
-        tmp[(FFT_SIZE - i) * 2 + 1] = -tmp[i * 2 + 1];
+      // Low pass: data is Hermitian (conjugate mirror), use real result ifft, need only FFT_SIZE/2 points
+      for (int i = sweep_points; i < FFT_SIZE/2; i++) {
+        tmp[i * 2 + 0] = 0.0;
+        tmp[i * 2 + 1] = 0.0;
       }
+      fft_real_inverse((float(*)[2])tmp);
+      // Real result x[i] = tmp[i], move to real part (imaginary cleared later)
+      for (int i = sweep_points - 1; i > 0; i--)
+        tmp[i * 2 + 0] = tmp[i];
+    }
+    else {
+    for (int i = sweep_points; i < FFT_SIZE; i++) {
+      tmp[i * 2 + 0] = 0.0;
+      tmp[i * 2 + 1] = 0.0;
     }
-
     fft_inverse((float(*)[2])tmp);
+    }
     memcpy(measured[ch], tmp, sizeof(measured[0]));
     for (int i = 0; i < sweep_points; i++) {
       measured[ch][i][0] /= (float)FFT_SIZE;
@@ -349,6 +405,78 @@ transform_domain(void)
   }
 }
 
+#ifdef __USE_TD_GATE__
+// Time gate: transform to time domain (as bandpass), multiply by gate window and transform back to frequency
+// Gate window shape and frequency pre-window set by TD_WINDOW (rectangular for minimum), gate time index = time * frequency step * FFT_SIZE
+// Applied once per completed sweep (new data only), last run time shown by 'transform gate'
+static systime_t gate_time = 0;
+static void
+gate_domain(void)
+{
+  systime_t time = chVTGetSystemTimeX();
+  float* tmp = (float*)spi_buffer;
+  float fstep = (frequencies[1] - frequencies[0]) * FFT_SIZE;
+  float start = td_gate_start * fstep;
+  float len = (td_gate_stop - td_gate_start) * fstep + 1.5f;
+  // Round and wrap negative time to buffer end
+  uint16_t g_start = (int32_t)(start < 0.0f ? start - 0.5f : start + 0.5f) & (FFT_SIZE - 1);
+  uint16_t g_len = len > FFT_SIZE ? FFT_SIZE : (len < 3.0f ? 3 : len);
+
+  // Gate window (half of symmetric window, scaled for ifft -> fft result) and frequency pre-window
+  // placed in spi_buffer after FFT buffer, calculated once per call (not use static RAM)
+#if (2*FFT_SIZE + FFT_SIZE/2 + POINTS_COUNT)*4 > (SPI_BUFFER_SIZE * LCD_PIXEL_SIZE)
+#error "Need increase spi_buffer for gate window"
+#endif
+  float *gate_table = &tmp[2 * FFT_SIZE];
+  for (int i = 0; i < (g_len + 1) / 2; i++)
+    gate_table[i] = td_window(i, g_len) * (1.0f / FFT_SIZE);
+  // Pre-window frequency data by TD_WINDOW (as bandpass transform), reduce time sidelobes leaking in gate,
+  // after gate window removed back. Edge points (window near zero) divided by GATE_PRE_WINDOW_MIN for limit noise gain
+#define GATE_PRE_WINDOW_MIN  0.1f
+  float *pre_window = NULL;
+  if ((domain_mode & TD_WINDOW) != TD_WINDOW_MINIMUM) {
+    pre_window = &gate_table[FFT_SIZE / 2];
+    for (int i = 0; i < sweep_points; i++)
+      pre_window[i] = td_window(i, sweep_points);
+  }
+
+  uint16_t ch_mask = get_sweep_mask();
+  for (int ch = 0; ch < 2; ch++,ch_mask>>=1) {
+    if ((ch_mask&1)==0) continue;
+    memcpy(tmp, measured[ch], sizeof(measured[0]));
+    if (pre_window) {
+      for (int i = 0; i < sweep_points; i++) {
+        tmp[i * 2 + 0] *= pre_window[i];
+        tmp[i * 2 + 1] *= pre_window[i];
+      }
+    }
+    for (int i = sweep_points; i < FFT_SIZE; i++) {
+      tmp[i * 2 + 0] = 0.0;
+      tmp[i * 2 + 1] = 0.0;
+    }
+    fft_inverse((float(*)[2])tmp);
+    for (int i = 0; i < FFT_SIZE; i++) {
+      uint16_t k = (i - g_start) & (FFT_SIZE - 1); // position in gate
+      float w = 0.0f;
+      if (k < g_len)
+        w = gate_table[k < (g_len + 1) / 2 ? k : g_len - 1 - k];
+      tmp[i * 2 + 0] *= w;
+      tmp[i * 2 + 1] *= w;
+    }
+    fft_forward((float(*)[2])tmp);
+    if (pre_window) {
+      for (int i = 0; i < sweep_points; i++) {
+        float w = 1.0f / (pre_window[i] > GATE_PRE_WINDOW_MIN ? pre_window[i] : GATE_PRE_WINDOW_MIN);
+        tmp[i * 2 + 0] *= w;
+        tmp[i * 2 + 1] *= w;
+      }
+    }
+    memcpy(measured[ch], tmp, sizeof(measured[0]));
+  }
+  gate_time = chVTGetSystemTimeX() - time;
+}
+#endif
+
 // Shell commands output
 static int shell_printf(const char *fmt, ...)
 {
@@ -671,20 +799,74 @@ VNA_SHELL_FUNCTION(cmd_clearconfig)
                "Do reset manually to take effect. Then do touch cal and save.\r\n");
 }
 
+// Get / set calibration data complex value
+#ifdef __USE_PACKED_CAL_DATA__
+// Packed value bits: [0:12] real, [13:25] imag (signed mantissa), [26:31] shared exponent
+// value = mantissa * 2^(exponent - CAL_PACK_EXP_BIAS - 12), max mantissa normalized to 2048 ... 4095
+// relative to |value| error < 3.5e-4 (-69dB), exponent range allow store values from 2^-40 to 2^23
+#define CAL_PACK_EXP_BIAS  40
+static void
+cal_get(const cal_value_t *c, float v[2])
+{
+  union {float f; uint32_t i;} scale;
+  uint32_t p = *c;
+  scale.i = ((p >> 26) - CAL_PACK_EXP_BIAS - 12 + 127) << 23;
+  v[0] = (((int32_t)(p << 19)) >> 19) * scale.f;
+  v[1] = (((int32_t)(p <<  6)) >> 19) * scale.f;
+}
+
+static void
+cal_set(cal_value_t *c, const float v[2])
+{
+  union {float f; uint32_t i;} u;
+  float re = fabsf(v[0]), im = fabsf(v[1]);
+  u.f = re > im ? re : im;
+  // Exponent of max component (value = f * 2^e, f = 0.5 ... 1.0)
+  int e = (int)((u.i >> 23) & 0xFF) - 126;
+  if (e < -CAL_PACK_EXP_BIAS)    e = -CAL_PACK_EXP_BIAS;
+  if (e > 63 - CAL_PACK_EXP_BIAS) e = 63 - CAL_PACK_EXP_BIAS;
+  // Scale to mantissa and round
+  u.i = (uint32_t)(12 - e + 127) << 23;
+  re = v[0] * u.f; re+= re < 0 ? -0.5f : 0.5f;
+  im = v[1] * u.f; im+= im < 0 ? -0.5f : 0.5f;
+  if (re > 4095.0f) re = 4095.0f; else if (re < -4096.0f) re = -4096.0f;
+  if (im > 4095.0f) im = 4095.0f; else if (im < -4096.0f) im = -4096.0f;
+  *c = ((uint32_t)(int32_t)re & 0x1FFF) | (((uint32_t)(int32_t)im & 0x1FFF) << 13) | ((uint32_t)(e + CAL_PACK_EXP_BIAS) << 26);
+}
+#else
+static inline void
+cal_get(const cal_value_t *c, float v[2])
+{
+  v[0] = (*c)[0];
+  v[1] = (*c)[1];
+}
+
+static inline void
+cal_set(cal_value_t *c, const float v[2])
+{
+  (*c)[0] = v[0];
+  (*c)[1] = v[1];
+}
+#endif
+
 VNA_SHELL_FUNCTION(cmd_data)
 {
   int i;
   int sel = 0;
-  float (*array)[2];
+  float v[2];
   if (argc == 1)
     sel = my_atoi(argv[0]);
   if (sel < 0 || sel >=7)
     goto usage;
 
-  array = sel < 2 ? measured[sel] : cal_data[sel-2];
-
-  for (i = 0; i < sweep_points; i++)
-    shell_printf("%f %f\r\n", array[i][0], array[i][1]);
+  for (i = 0; i < sweep_points; i++) {
+    if (sel < 2) {
+      v[0] = measured[sel][i][0];
+      v[1] = measured[sel][i][1];
+    } else
+      cal_get(&cal_data[sel-2][i], v);
+    shell_printf("%f %f\r\n", v[0], v[1]);
+  }
   return;
 usage:
   shell_printf("usage: data [array]\r\n");
@@ -714,15 +896,42 @@ VNA_SHELL_FUNCTION(cmd_dump)
 }
 #endif
 
+static bool capture_write(const void *data, uint16_t size)
+{
+  streamWrite(shell_stream, (void *)data, size);
+  return true;
+}
+
+// Send rendered cell: x, y, w, h (uint16_t) and w*h pixels (in LCD byte order, as capture)
+static void capture_cell(int x, int y, int w, int h, pixel_t *buf)
+{
+  uint16_t head[4] = {x, y, w, h};
+  streamWrite(shell_stream, (void *)head, sizeof(head));
+  streamWrite(shell_stream, (void *)buf, w * h * sizeof(pixel_t));
+}
+
 VNA_SHELL_FUNCTION(cmd_capture)
 {
 // read pixel count at one time (PART*2 bytes required for read buffer)
-  (void)argc;
-  (void)argv;
   int y;
 #if (SPI_BUFFER_SIZE*LCD_PIXEL_SIZE) < (3*LCD_WIDTH*2)
 #error "Low size of spi_buffer for cmd_capture"
 #endif
+  // capture rle: send RLE8 compressed BMP file (file and image size in header not set, end by end of bitmap code)
+  //              or raw 16bpp BMP file if screen have not palette colors
+  // capture cells: render plot area cells and send it (not use LCD read)
+  int mode = argc == 1 ? get_str_index(argv[0], "rle|cells") : -1;
+  if (mode == 0) {
+    lcd_screenshot_bmp(capture_write, lcd_screenshot_palette_only(), false);
+    return;
+  }
+  if (mode == 1) {
+    render_all_cells(capture_cell);
+    // End mark (zero size cell)
+    uint16_t end[4] = {0, 0, 0, 0};
+    streamWrite(shell_stream, (void *)end, sizeof(end));
+    return;
+  }
   // read 2 row pixel time (read buffer limit by 2/3 + 1 from spi_buffer size)
   for (y = 0; y < LCD_HEIGHT; y += 2) {
     // use uint16_t spi_buffer[2048] (defined in ili9341) for read buffer
@@ -829,7 +1038,7 @@ void load_default_properties(void)
 
 int load_properties(uint32_t id){
   int r = caldata_recall(id);
-  update_frequencies(false);
+  update_sweep_range();
   return r;
 }
 
@@ -904,6 +1113,12 @@ extern uint16_t timings[16];
 #define DSP_START(delay) {ready_time = chVTGetSystemTimeX() + delay; wait_count = config.bandwidth+2;}
 #define DSP_WAIT         while (wait_count) {__WFI();}
 #define RESET_SWEEP      {p_sweep = 0;}
+#ifdef __USE_SD_CARD_LOG__
+// Log previous point calibrated data (or start new record on first point), card write overlap DSP delay
+#define SWEEP_LOG_POINT(p, mask) {if (sweep_mode & SWEEP_LOG) {if (p) sd_card_log_point(p - 1); else sd_card_log_start(mask);}}
+#else
+#define SWEEP_LOG_POINT(p, mask) {}
+#endif
 
 #define SWEEP_CH0_MEASURE   1
 #define SWEEP_CH1_MEASURE   2
@@ -927,6 +1142,9 @@ static bool sweep(bool break_on_operation, uint16_t ch_mask)
   if (p_sweep>=sweep_points || break_on_operation == false) RESET_SWEEP;
   if (break_on_operation && ch_mask == 0)
     return false;
+  // Measured channels data changed
+  if (ch_mask & SWEEP_CH0_MEASURE) measured_version[0]++;
+  if (ch_mask & SWEEP_CH1_MEASURE) measured_version[1]++;
   // Blink LED while scanning
   palClearPad(GPIOC, GPIOC_LED);
 //  START_PROFILE;
@@ -943,6 +1161,7 @@ static bool sweep(bool break_on_operation, uint16_t ch_mask)
       //================================================
       // Place some code thats need execute while delay
       //================================================
+      SWEEP_LOG_POINT(p_sweep, ch_mask);
       DSP_WAIT;
       (*sample_func)(measured[0][p_sweep]);      // calculate reflection coefficient
       if (APPLY_CALIBRATION_AFTER_SWEEP == 0 && (cal_status & CALSTAT_APPLY))
@@ -955,6 +1174,7 @@ static bool sweep(bool break_on_operation, uint16_t ch_mask)
       //================================================
       // Place some code thats need execute while delay
       //================================================
+      if (!(ch_mask & SWEEP_CH0_MEASURE)) SWEEP_LOG_POINT(p_sweep, ch_mask);
       DSP_WAIT;
       (*sample_func)(measured[1][p_sweep]);      // Measure transmission coefficient
       if (APPLY_CALIBRATION_AFTER_SWEEP == 0 && (cal_status & CALSTAT_APPLY))
@@ -969,6 +1189,8 @@ static bool sweep(bool break_on_operation, uint16_t ch_mask)
   ili9341_set_background(LCD_GRID_COLOR);
   if (config.bandwidth >= BANDWIDTH_100)
     ili9341_fill(OFFSETX+CELLOFFSETX, OFFSETY, WIDTH, 1);
+  // Log last point
+  if (p_sweep == sweep_points) SWEEP_LOG_POINT(p_sweep, ch_mask);
   // Apply calibration at end if need
   if (APPLY_CALIBRATION_AFTER_SWEEP && (cal_status & CALSTAT_APPLY) && p_sweep == sweep_points){
     uint16_t start_sweep;
@@ -1194,8 +1416,9 @@ set_frequencies(uint32_t start, uint32_t stop, uint16_t points)
     frequencies[i] = 0;
 }
 
-static void
-update_frequencies(bool interpolate)
+// Rebuild frequency table, markers and grid for sweep range (calibration not changed, used after recall)
+void
+update_sweep_range(void)
 {
   uint32_t start, stop;
   start = get_sweep_frequency(ST_START);
@@ -1206,9 +1429,18 @@ update_frequencies(bool interpolate)
   update_marker_index();
   // set grid layout
   update_grid();
+  RESET_SWEEP;
+}
+
+void
+update_frequencies(bool interpolate)
+{
+  update_sweep_range();
+  // Auto select calibration slot for new range also if calibration not applied now (used on apply)
   if (interpolate)
     cal_interpolate();
-  RESET_SWEEP;
+  else
+    cal_auto_select();
 }
 
 void
@@ -1331,10 +1563,9 @@ static void
 eterm_set(int term, float re, float im)
 {
   int i;
-  for (i = 0; i < sweep_points; i++) {
-    cal_data[term][i][0] = re;
-    cal_data[term][i][1] = im;
-  }
+  float v[2] = {re, im};
+  for (i = 0; i < sweep_points; i++)
+    cal_set(&cal_data[term][i], v);
 }
 
 static void
@@ -1386,20 +1617,25 @@ eterm_calc_es(void)
     float s11aor = (1 - z*z) / sq;
     float s11aoi = 2*z / sq;
 
+    float open[2], shrt[2], ed[2], es[2];
+    cal_get(&cal_data[CAL_OPEN][i], open);
+    cal_get(&cal_data[CAL_SHORT][i], shrt);
+    cal_get(&cal_data[ETERM_ED][i], ed);
     // S11mo’= S11mo - Ed
     // S11ms’= S11ms - Ed
-    float s11or = cal_data[CAL_OPEN][i][0] - cal_data[ETERM_ED][i][0];
-    float s11oi = cal_data[CAL_OPEN][i][1] - cal_data[ETERM_ED][i][1];
-    float s11sr = cal_data[CAL_SHORT][i][0] - cal_data[ETERM_ED][i][0];
-    float s11si = cal_data[CAL_SHORT][i][1] - cal_data[ETERM_ED][i][1];
+    float s11or = open[0] - ed[0];
+    float s11oi = open[1] - ed[1];
+    float s11sr = shrt[0] - ed[0];
+    float s11si = shrt[1] - ed[1];
     // Es = (S11mo'/s11ao + S11ms’)/(S11mo' - S11ms’)
     float numr = s11sr + s11or * s11aor - s11oi * s11aoi;
     float numi = s11si + s11oi * s11aor + s11or * s11aoi;
     float denomr = s11or - s11sr;
     float denomi = s11oi - s11si;
     sq = denomr*denomr+denomi*denomi;
-    cal_data[ETERM_ES][i][0] = (numr*denomr + numi*denomi)/sq;
-    cal_data[ETERM_ES][i][1] = (numi*denomr - numr*denomi)/sq;
+    es[0] = (numr*denomr + numi*denomi)/sq;
+    es[1] = (numi*denomr - numr*denomi)/sq;
+    cal_set(&cal_data[ETERM_ES][i], es);
   }
   cal_status &= ~CALSTAT_OPEN;
   cal_status |= CALSTAT_ES;
@@ -1410,11 +1646,15 @@ eterm_calc_er(int sign)
 {
   int i;
   for (i = 0; i < sweep_points; i++) {
+    float shrt[2], ed[2], es[2], er[2];
+    cal_get(&cal_data[CAL_SHORT][i], shrt);
+    cal_get(&cal_data[ETERM_ED][i], ed);
+    cal_get(&cal_data[ETERM_ES][i], es);
     // Er = sign*(1-sign*Es)S11ms'
-    float s11sr = cal_data[CAL_SHORT][i][0] - cal_data[ETERM_ED][i][0];
-    float s11si = cal_data[CAL_SHORT][i][1] - cal_data[ETERM_ED][i][1];
-    float esr = cal_data[ETERM_ES][i][0];
-    float esi = cal_data[ETERM_ES][i][1];
+    float s11sr = shrt[0] - ed[0];
+    float s11si = shrt[1] - ed[1];
+    float esr = es[0];
+    float esi = es[1];
     if (sign > 0) {
       esr = -esr;
       esi = -esi;
@@ -1426,8 +1666,9 @@ eterm_calc_er(int sign)
       err = -err;
       eri = -eri;
     }
-    cal_data[ETERM_ER][i][0] = err;
-    cal_data[ETERM_ER][i][1] = eri;
+    er[0] = err;
+    er[1] = eri;
+    cal_set(&cal_data[ETERM_ER][i], er);
   }
   cal_status &= ~CALSTAT_SHORT;
   cal_status |= CALSTAT_ER;
@@ -1439,14 +1680,16 @@ eterm_calc_et(void)
 {
   int i;
   for (i = 0; i < sweep_points; i++) {
+    float thru[2], isoln[2], et[2];
+    cal_get(&cal_data[CAL_THRU][i], thru);
+    cal_get(&cal_data[CAL_ISOLN][i], isoln);
     // Et = 1/(S21mt - Ex)
-    float etr = cal_data[CAL_THRU][i][0] - cal_data[CAL_ISOLN][i][0];
-    float eti = cal_data[CAL_THRU][i][1] - cal_data[CAL_ISOLN][i][1];
+    float etr = thru[0] - isoln[0];
+    float eti = thru[1] - isoln[1];
     float sq = etr*etr + eti*eti;
-    float invr = etr / sq;
-    float invi = -eti / sq;
-    cal_data[ETERM_ET][i][0] = invr;
-    cal_data[ETERM_ET][i][1] = invi;
+    et[0] = etr / sq;
+    et[1] =-eti / sq;
+    cal_set(&cal_data[ETERM_ET][i], et);
   }
   cal_status &= ~CALSTAT_THRU;
   cal_status |= CALSTAT_ET;
@@ -1523,12 +1766,16 @@ static void apply_error_term_at(int i)
 
 static void apply_CH0_error_term_at(int i)
 {
+    float ed[2], er[2], es[2];
+    cal_get(&cal_data[ETERM_ED][i], ed);
+    cal_get(&cal_data[ETERM_ER][i], er);
+    cal_get(&cal_data[ETERM_ES][i], es);
     // S11m' = S11m - Ed
     // S11a = S11m' / (Er + Es S11m')
-    float s11mr = measured[0][i][0] - cal_data[ETERM_ED][i][0];
-    float s11mi = measured[0][i][1] - cal_data[ETERM_ED][i][1];
-    float err = cal_data[ETERM_ER][i][0] + s11mr * cal_data[ETERM_ES][i][0] - s11mi * cal_data[ETERM_ES][i][1];
-    float eri = cal_data[ETERM_ER][i][1] + s11mr * cal_data[ETERM_ES][i][1] + s11mi * cal_data[ETERM_ES][i][0];
+    float s11mr = measured[0][i][0] - ed[0];
+    float s11mi = measured[0][i][1] - ed[1];
+    float err = er[0] + s11mr * es[0] - s11mi * es[1];
+    float eri = er[1] + s11mr * es[1] + s11mi * es[0];
     float sq = err*err + eri*eri;
     float s11ar = (s11mr * err + s11mi * eri) / sq;
     float s11ai = (s11mi * err - s11mr * eri) / sq;
@@ -1538,13 +1785,16 @@ static void apply_CH0_error_term_at(int i)
 
 static void apply_CH1_error_term_at(int i)
 {
+    float ex[2], et[2];
+    cal_get(&cal_data[ETERM_EX][i], ex);
+    cal_get(&cal_data[ETERM_ET][i], et);
     // CAUTION: Et is inversed for efficiency
     // S21a = (S21m - Ex) * Et
-    float s21mr = measured[1][i][0] - cal_data[ETERM_EX][i][0];
-    float s21mi = measured[1][i][1] - cal_data[ETERM_EX][i][1];
+    float s21mr = measured[1][i][0] - ex[0];
+    float s21mi = measured[1][i][1] - ex[1];
     // Not made CH1 correction by CH0 data
-    float s21ar = s21mr * cal_data[ETERM_ET][i][0] - s21mi * cal_data[ETERM_ET][i][1];
-    float s21ai = s21mi * cal_data[ETERM_ET][i][0] + s21mr * cal_data[ETERM_ET][i][1];
+    float s21ar = s21mr * et[0] - s21mi * et[1];
+    float s21ai = s21mi * et[0] + s21mr * et[1];
     measured[1][i][0] = s21ar;
     measured[1][i][1] = s21ai;
 }
@@ -1623,7 +1873,9 @@ cal_collect(uint16_t type)
   config.bandwidth = bw;          // restore
 
   // Copy calibration data
-  memcpy(cal_data[dst], measured[src], sizeof measured[0]);
+  int i;
+  for (i = 0; i < sweep_points; i++)
+    cal_set(&cal_data[dst][i], measured[src][i]);
   redraw_request |= REDRAW_CAL_STATUS;
 }
 
@@ -1663,14 +1915,35 @@ cal_done(void)
   redraw_request |= REDRAW_CAL_STATUS;
 }
 
+// Select best saved calibration for sweep range
+static void
+cal_auto_select(void)
+{
+  if (config._mode & VNA_MODE_AUTO_CAL) {
+    uint16_t id = caldata_select(frequency0, frequency1);
+    if (id != NO_SAVE_SLOT)
+      lastsaveid = id;
+  }
+}
+
 static void
 cal_interpolate(void)
 {
-  const properties_t *src = caldata_reference();
   uint32_t i, j;
   int eterm;
+  float v[2], v0[2], v1[2];
+  cal_auto_select();
+  const properties_t *src = caldata_reference();
   if (src == NULL)
     return;
+  // Saved range and points same as sweep, copy it (no interpolate)
+  if (src->_frequency0 == frequency0 && src->_frequency1 == frequency1 && src->_sweep_points == sweep_points) {
+    memcpy(current_props._cal_data, src->_cal_data, sizeof(current_props._cal_data));
+    active_props = (properties_t *)src;
+    cal_status = src->_cal_status;
+    redraw_request |= REDRAW_CAL_STATUS;
+    return;
+  }
 
   ensure_edit_config();
 
@@ -1681,10 +1954,8 @@ cal_interpolate(void)
       break;
 
     // fill cal_data at head of src range
-    for (eterm = 0; eterm < 5; eterm++) {
-      cal_data[eterm][i][0] = src->_cal_data[eterm][0][0];
-      cal_data[eterm][i][1] = src->_cal_data[eterm][0][1];
-    }
+    for (eterm = 0; eterm < 5; eterm++)
+      memcpy(&cal_data[eterm][i], &src->_cal_data[eterm][0], sizeof(cal_value_t));
   }
 
   // ReBuild src freq list
@@ -1723,8 +1994,11 @@ cal_interpolate(void)
         }
         float k0 = 1.0 - k1;
         for (eterm = 0; eterm < 5; eterm++) {
-          cal_data[eterm][i][0] = src->_cal_data[eterm][idx][0] * k0 + src->_cal_data[eterm][idx+1][0] * k1;
-          cal_data[eterm][i][1] = src->_cal_data[eterm][idx][1] * k0 + src->_cal_data[eterm][idx+1][1] * k1;
+          cal_get(&src->_cal_data[eterm][idx  ], v0);
+          cal_get(&src->_cal_data[eterm][idx+1], v1);
+          v[0] = v0[0] * k0 + v1[0] * k1;
+          v[1] = v0[1] * k0 + v1[1] * k1;
+          cal_set(&cal_data[eterm][i], v);
         }
         break;
       }
@@ -1738,10 +2012,8 @@ cal_interpolate(void)
   // upper than end freq of src range
   for (; i < sweep_points; i++) {
     // fill cal_data at tail of src
-    for (eterm = 0; eterm < 5; eterm++) {
-      cal_data[eterm][i][0] = src->_cal_data[eterm][src_points][0];
-      cal_data[eterm][i][1] = src->_cal_data[eterm][src_points][1];
-    }
+    for (eterm = 0; eterm < 5; eterm++)
+      memcpy(&cal_data[eterm][i], &src->_cal_data[eterm][src_points], sizeof(cal_value_t));
   }
 interpolate_finish:
   cal_status |= src->_cal_status | CALSTAT_APPLY | CALSTAT_INTERPOLATED;
@@ -2110,7 +2382,7 @@ set_timedomain_func(int func) // accept TD_FUNC_LOWPASS_IMPULSE, TD_FUNC_LOWPASS
 }
 
 static void
-set_timedomain_window(int func) // accept TD_WINDOW_MINIMUM/TD_WINDOW_NORMAL/TD_WINDOW_MAXIMUM
+set_timedomain_window(int func) // accept TD_WINDOW_MINIMUM/TD_WINDOW_NORMAL/TD_WINDOW_MAXIMUM/TD_WINDOW_HANN/TD_WINDOW_BLACKMAN
 {
   domain_mode = (domain_mode & ~TD_WINDOW) | (func & TD_WINDOW);
 }
@@ -2121,8 +2393,17 @@ VNA_SHELL_FUNCTION(cmd_transform)
   if (argc == 0) {
     goto usage;
   }
-  //                                         0   1       2    3        4       5      6       7
-  static const char cmd_transform_list[] = "on|off|impulse|step|bandpass|minimum|normal|maximum";
+  //                                         0   1       2    3        4       5      6       7       8    9
+  static const char cmd_transform_list[] = "on|off|impulse|step|bandpass|minimum|normal|maximum|hann|blackman"
+#ifdef __USE_TD_ZOOM__
+  //  10
+    "|zoom"
+#endif
+#ifdef __USE_TD_GATE__
+  //  11
+    "|gate"
+#endif
+  ;
   for (i = 0; i < argc; i++) {
     switch (get_str_index(argv[i], cmd_transform_list)) {
       case 0:
@@ -2149,6 +2430,35 @@ VNA_SHELL_FUNCTION(cmd_transform)
       case 7:
         set_timedomain_window(TD_WINDOW_MAXIMUM);
         return;
+      case 8:
+        set_timedomain_window(TD_WINDOW_HANN);
+        return;
+      case 9:
+        set_timedomain_window(TD_WINDOW_BLACKMAN);
+        return;
+#ifdef __USE_TD_ZOOM__
+      case 10:
+        // zoom {start} {stop} in seconds, zoom off if stop <= start
+        if (i + 2 >= argc) goto usage;
+        td_zoom_start = my_atof(argv[i+1]);
+        td_zoom_stop  = my_atof(argv[i+2]);
+        redraw_request|= REDRAW_FREQUENCY | REDRAW_MARKER;
+        return;
+#endif
+#ifdef __USE_TD_GATE__
+      case 11:
+        // gate {start} {stop} in seconds, gate off if stop <= start
+        // without parameters show gate and last apply time (per sweep cost)
+        if (i + 1 == argc) {
+          shell_printf("gate %f %f s, %d ticks/sweep (10 ticks = 1ms)\r\n", td_gate_start, td_gate_stop, gate_time);
+          return;
+        }
+        if (i + 2 >= argc) goto usage;
+        td_gate_start = my_atof(argv[i+1]);
+        td_gate_stop  = my_atof(argv[i+2]);
+        redraw_request|= REDRAW_CAL_STATUS;
+        return;
+#endif
       default:
         goto usage;
     }
@@ -2441,6 +2751,21 @@ VNA_SHELL_FUNCTION(cmd_lcd){
 }
 #endif
 
+#ifdef ENABLE_FRAME_TIME_COMMAND
+VNA_SHELL_FUNCTION(cmd_frametime)
+{
+  int i, count = argc > 0 ? my_atoi(argv[0]) : 10;
+  if (count <= 0) count = 1;
+  systime_t time = chVTGetSystemTimeX();
+  for (i = 0; i < count; i++) {
+    redraw_request|= REDRAW_AREA;
+    draw_all(true);
+  }
+  time = chVTGetSystemTimeX() - time;
+  shell_printf("full redraw %d ticks/frame (10 ticks = 1ms)\r\n", time / count);
+}
+#endif
+
 #ifdef ENABLE_THREADS_COMMAND
 #if CH_CFG_USE_REGISTRY == FALSE
 #error "Threads Requite enabled CH_CFG_USE_REGISTRY in chconf.h"
@@ -2510,6 +2835,11 @@ static FATFS *fs_volume   = (FATFS *)(((uint8_t*)(&spi_buffer[SPI_BUFFER_SIZE]))
 static FIL   *fs_file     = (   FIL*)(((uint8_t*)(&spi_buffer[SPI_BUFFER_SIZE])) - sizeof(FATFS) - sizeof(FIL));
 
 static FRESULT cmd_sd_card_mount(void){
+#ifdef __USE_SD_CARD_LOG__
+  // Sweep log volume already mounted
+  if (sweep_mode & SWEEP_LOG)
+    return FR_OK;
+#endif
   const FRESULT res = f_mount(fs_volume, "", 1);
   if (res != FR_OK)
     shell_printf("error: card not mounted\r\n");
@@ -2641,7 +2971,7 @@ static const VNAShellCommand commands[] =
     {"pause"       , cmd_pause       , CMD_WAIT_MUTEX|CMD_BREAK_SWEEP},
     {"resume"      , cmd_resume      , CMD_WAIT_MUTEX|CMD_BREAK_SWEEP},
     {"cal"         , cmd_cal         , CMD_WAIT_MUTEX},
-    {"save"        , cmd_save        , 0},
+    {"save"        , cmd_save        , CMD_WAIT_MUTEX|CMD_BREAK_SWEEP},
     {"recall"      , cmd_recall      , CMD_WAIT_MUTEX|CMD_BREAK_SWEEP},
     {"trace"       , cmd_trace       , 0},
     {"marker"      , cmd_marker      , 0},
@@ -2682,6 +3012,9 @@ static const VNAShellCommand commands[] =
 #ifdef ENABLE_THREADS_COMMAND
     {"threads"     , cmd_threads     , 0},
 #endif
+#ifdef ENABLE_FRAME_TIME_COMMAND
+    {"frametime"   , cmd_frametime   , CMD_WAIT_MUTEX},
+#endif
 #ifdef ENABLE_SI5351_TIMINGS
     {"t"           , cmd_si5351time  , CMD_WAIT_MUTEX},
 #endif
@@ -32,10 +32,33 @@
 #define __USE_RTC__
 // Add SD card support, req enable RTC (additional settings for file system see FatFS lib ffconf.h)
 #define __USE_SD_CARD__
+// Add SD card sweep logger (append all completed sweep data to log file on SD card)
+// Need 600 bytes RAM for own file system objects, F072 not have it
+#ifdef NANOVNA_F303
+#define __USE_SD_CARD_LOG__
+#endif
+// Add SD card calibration library (save/load properties_t to files, index file for fast list)
+#define __USE_SD_CARD_CAL__
 // If enabled serial in halconf.h, possible enable serial console control
 #define __USE_SERIAL_CONSOLE__
 // Add LC match function
 #define __USE_LC_MATCHING__
+// Time domain zoom: transform to user time window by Chirp-Z transform (need 4 * FFT_SIZE floats in spi_buffer)
+#define __USE_TD_ZOOM__
+// Time domain gate: remove reflections outside time window from measured data (IFFT, gate, FFT back to frequency)
+#define __USE_TD_GATE__
+// Cache Smith/polar grid (F303 store 1 bit per pixel mask, F072 variant store run-length spans 1752 bytes,
+// but F072 not have free RAM for it, so by default enabled only on F303)
+#ifdef NANOVNA_F303
+#define __USE_GRID_CACHE__
+#endif
+// Cache time domain window as table (POINTS_COUNT * 2 bytes RAM), else window calculated on every transform
+#ifdef NANOVNA_F303
+#define __USE_TD_WINDOW_TABLE__
+#endif
+// Store calibration data packed (complex value as 2 x 13 bit mantissa + shared 6 bit exponent, 4 bytes instead 8)
+// allow more POINTS_COUNT or save slots in same flash area (not compatible with float saved calibration)
+//#define __USE_PACKED_CAL_DATA__
 // Use buildin table for sin/cos calculation, allow save a lot of flash space (this table also use for FFT), max sin/cos error = 4e-7
 #define __VNA_USE_MATH_TABLES__
 
@@ -144,6 +167,7 @@
 #endif
 
 extern float measured[2][POINTS_COUNT][2];
+extern uint16_t measured_version[2];
 extern uint32_t frequencies[POINTS_COUNT];
 
 #define CAL_LOAD  0
@@ -178,10 +202,13 @@ extern uint32_t frequencies[POINTS_COUNT];
 #define TD_FUNC_BANDPASS (0b00<<1)
 #define TD_FUNC_LOWPASS_IMPULSE (0b01<<1)
 #define TD_FUNC_LOWPASS_STEP    (0b10<<1)
-#define TD_WINDOW (0b11<<3)
+// Window type: Kaiser (beta set by bits 3-4) or Hann, Blackman (bits 6-7)
+#define TD_WINDOW ((0b11<<3)|(0b11<<6))
 #define TD_WINDOW_NORMAL (0b00<<3)
 #define TD_WINDOW_MINIMUM (0b01<<3)
 #define TD_WINDOW_MAXIMUM (0b10<<3)
+#define TD_WINDOW_HANN     (0b01<<6)
+#define TD_WINDOW_BLACKMAN (0b10<<6)
 // L/C match enable option
 #define TD_LC_MATH        (1<<5)
 
@@ -191,8 +218,22 @@ extern uint32_t frequencies[POINTS_COUNT];
 #define FFT_SIZE   512
 #endif
 
+#ifdef __USE_TD_ZOOM__
+// Zoom window set and can be used (step response not zoomed, Chirp-Z need sweep_points * 2 - 1 <= FFT_SIZE)
+#define TD_ZOOM_ENABLED() (td_zoom_stop > td_zoom_start && \
+                           (domain_mode & TD_FUNC) != TD_FUNC_LOWPASS_STEP && sweep_points * 2 - 1 <= FFT_SIZE)
+#endif
+
+#ifdef __USE_TD_GATE__
+// Gate window set and can be used (need frequency step)
+#define TD_GATE_ENABLED() (td_gate_stop > td_gate_start && !FREQ_IS_CW())
+#endif
+
 // Return sin/cos value, angle have range 0.0 to 1.0 (0 is 0 degree, 1 is 360 degree)
 void vna_sin_cos(float angle, float * pSinVal, float * pCosVal);
+// Fast log10 and atan2 (not use libm if enabled __VNA_USE_MATH_TABLES__)
+float vna_log10f(float x);
+float vna_atan2f(float y, float x);
 
 void cal_collect(uint16_t type);
 void cal_done(void);
@@ -216,11 +257,14 @@ double   my_atof(const char *p);
 void toggle_sweep(void);
 void load_default_properties(void);
 int  load_properties(uint32_t id);
+void update_frequencies(bool interpolate);
+void update_sweep_range(void);
 void set_sweep_points(uint16_t points);
 
 #define SWEEP_ENABLE  0x01
 #define SWEEP_ONCE    0x02
 #define SWEEP_BINARY  0x08
+#define SWEEP_LOG     0x10
 
 extern  uint8_t sweep_mode;
 extern const char *info_about[];
@@ -472,6 +516,16 @@ enum marker_smithvalue {
 #define VNA_MODE_CONNECTION_MASK  0x04
 #define VNA_MODE_SERIAL           0x04
 #define VNA_MODE_USB              0x00
+// Touchstone file data format and frequency unit (SD card save)
+#define VNA_MODE_S_FORMAT_MASK    0x18
+#define VNA_MODE_S_FORMAT_RI      0x00
+#define VNA_MODE_S_FORMAT_MA      0x08
+#define VNA_MODE_S_FORMAT_DB      0x10
+#define VNA_MODE_S_UNIT_MHZ       0x20
+// Auto select saved calibration slot for interpolate on sweep range change
+#define VNA_MODE_AUTO_CAL         0x40
+// Screenshot file in RLE8 compressed BMP format (if all pixels is palette colors)
+#define VNA_MODE_BMP_RLE          0x80
 
 #define TRACES_MAX 4
 typedef struct trace {
@@ -504,10 +558,23 @@ typedef struct config {
   uint32_t _serial_config;
   uint8_t  _mode;
   uint8_t _brightness;
-  uint8_t _reserved[24];
+  float    _td_zoom_start;  // time domain zoom window (seconds), disabled if stop <= start
+  float    _td_zoom_stop;
+  float    _td_gate_start;  // time domain gate window (seconds), disabled if stop <= start
+  float    _td_gate_stop;
+  uint8_t _reserved[8];
   uint32_t checksum;
 } config_t; // sizeof = 108
 
+// Calibration data complex value
+#ifdef __USE_PACKED_CAL_DATA__
+typedef uint32_t cal_value_t;
+#define CAL_VALUE_SIZE    4
+#else
+typedef float    cal_value_t[2];
+#define CAL_VALUE_SIZE    8
+#endif
+
 typedef struct properties {
   uint32_t magic;
   uint32_t _frequency0;
@@ -515,7 +582,7 @@ typedef struct properties {
   uint16_t _sweep_points;
   uint16_t _cal_status;
 
-  float _cal_data[5][POINTS_COUNT][2];
+  cal_value_t _cal_data[5][POINTS_COUNT];
   float _electrical_delay; // picoseconds
 
   trace_t _trace[TRACES_MAX];
@@ -523,12 +590,13 @@ typedef struct properties {
 
   float _velocity_factor; // %
   int8_t _active_marker;
-  uint8_t _domain_mode; /* 0bxxxxxffm : where ff: TD_FUNC m: DOMAIN_MODE */
+  uint8_t _domain_mode; /* 0bwwxwwffm : where ww: TD_WINDOW ff: TD_FUNC m: DOMAIN_MODE */
   uint8_t _marker_smith_format;
   uint8_t _power;
   uint32_t checksum;
 } properties_t;
 //on POINTS_COUNT = 101, sizeof(properties_t) == 4152 (need reduce size on 56 bytes to 4096 for more compact save slot size)
+//packed cal data, on POINTS_COUNT = 101 sizeof(properties_t) == 2132, on POINTS_COUNT = 401 sizeof(properties_t) == 8132
 
 extern config_t config;
 extern properties_t *active_props;
@@ -593,11 +661,17 @@ extern  uint8_t redraw_request;
  * ili9341.c
  */
 // Set display buffers count for cell render (if use 2 and DMA, possible send data and prepare new in some time)
+// Cell size not depend from buffers count, spi_buffer size = cell size * DISPLAY_CELL_BUFFER_COUNT
 #ifdef __USE_DISPLAY_DMA__
-// Cell size = sizeof(spi_buffer), but need wait while cell cata send to LCD
+#ifdef NANOVNA_F303
+// spi_buffer = 2 cells, while one cell send to LCD by DMA, CPU render to next cell (need more RAM)
+#define DISPLAY_CELL_BUFFER_COUNT     2
+#else
+// spi_buffer = 1 cell, but need wait while cell data send to LCD
+// F072 not have RAM for 2 full cells: second 64x32 cell need +4096 bytes, but static data
+// (main, ui, plot, ili9341) already use ~13-17kB of 16kB RAM (stacks not included)
 #define DISPLAY_CELL_BUFFER_COUNT     1
-// Cell size = sizeof(spi_buffer)/2, while one cell send to LCD by DMA, CPU render to next cell
-//#define DISPLAY_CELL_BUFFER_COUNT     2
+#endif
 #else
 // Always one if no DMA mode
 #define DISPLAY_CELL_BUFFER_COUNT     1
@@ -618,11 +692,11 @@ typedef uint8_t pixel_t;
 #define RGBHEX(hex)    ( (((hex)&0xE00000)>>16) | (((hex)&0x00E000)>>11) | (((hex)&0x0000C0)>>6) )
 #define HEXRGB(hex)    ( (((hex)<<16)&0xE00000) | (((hex)<<11)&0x00E000) | (((hex)<<6)&0x0000C0) )
 #define LCD_PIXEL_SIZE        1
-// Cell size, depends from spi_buffer size, CELLWIDTH*CELLHEIGHT*sizeof(pixel) <= sizeof(spi_buffer)
-#define CELLWIDTH  (64/DISPLAY_CELL_BUFFER_COUNT)
+// Cell size, CELLWIDTH*CELLHEIGHT*DISPLAY_CELL_BUFFER_COUNT = spi_buffer size
+#define CELLWIDTH  (64)
 #define CELLHEIGHT (64)
 // Define size of screen buffer in pixel_t
-#define SPI_BUFFER_SIZE             4096
+#define SPI_BUFFER_SIZE             (CELLWIDTH*CELLHEIGHT*DISPLAY_CELL_BUFFER_COUNT)
 #endif
 
 #ifdef LCD_16BIT_MODE
@@ -633,11 +707,11 @@ typedef uint16_t pixel_t;
 #define RGBHEX(hex) ( (((hex)&0x001c00)<<3) | (((hex)&0x0000f8)<<5) | (((hex)&0xf80000)>>16) | (((hex)&0x00e000)>>13) )
 #define HEXRGB(hex) ( (((hex)>>3)&0x001c00) | (((hex)>>5)&0x0000f8) | (((hex)<<16)&0xf80000) | (((hex)<<13)&0x00e000) )
 #define LCD_PIXEL_SIZE        2
-// Cell size, depends from spi_buffer size, CELLWIDTH*CELLHEIGHT*sizeof(pixel) <= sizeof(spi_buffer)
-#define CELLWIDTH  (64/DISPLAY_CELL_BUFFER_COUNT)
+// Cell size, CELLWIDTH*CELLHEIGHT*DISPLAY_CELL_BUFFER_COUNT = spi_buffer size
+#define CELLWIDTH  (64)
 #define CELLHEIGHT (32)
 // Define size of screen buffer in pixel_t
-#define SPI_BUFFER_SIZE             2048
+#define SPI_BUFFER_SIZE             (CELLWIDTH*CELLHEIGHT*DISPLAY_CELL_BUFFER_COUNT)
 #endif
 
 #ifndef SPI_BUFFER_SIZE
@@ -725,6 +799,21 @@ void ili9341_line(int x0, int y0, int x1, int y1);
 uint32_t lcd_send_command(uint8_t cmd, uint8_t len, const uint8_t *data);
 void     lcd_setBrightness(uint16_t b);
 
+// Screenshot in BMP format, raw 16bpp or RLE8 compressed (palette = LCD palette)
+#define BMP_RLE8_PALETTE       MAX_PALETTE
+#define BMP_RLE8_DATA_OFFSET   (14 + 40 + BMP_RLE8_PALETTE*4)
+// File size and bitmap size fields in BMP header, set it after RLE8 encode
+#define BMP_FILE_SIZE_OFFSET    2
+#define BMP_IMAGE_SIZE_OFFSET  34
+bool     lcd_screenshot_palette_only(void);
+uint32_t lcd_screenshot_bmp(bool (*out)(const void *data, uint16_t size), bool rle8, bool render);
+// Redirect LCD fill and bulk output to buffer rows y ... y + h - 1 (buf = NULL - output to LCD)
+void ili9341_set_render_target(pixel_t *buf, int y, int h);
+// Render plot cells to out function, not to LCD (implemented in plot.c)
+void render_all_cells(void (*out)(int x, int y, int w, int h, pixel_t *buf));
+// Render screen rows y ... y + h - 1 to buf, LCD not used (implemented in plot.c)
+void render_screen_rows(int y, int h, pixel_t *buf);
+
 // SD Card support, discio functions for FatFS lib implemented in ili9341.c
 #ifdef  __USE_SD_CARD__
 #include "../FatFs/ff.h"
@@ -769,15 +858,21 @@ void rtc_set_time(uint32_t dr, uint32_t tr);
 
 #define FLASH_PAGESIZE 0x800
 
-#define SAVEAREA_MAX 5
-
+// Save config_t and properties_t flash area (see flash7  : org = 0x08018000, len = 32k from *.ld settings)
+#define SAVE_AREA_SIZE          0x00008000
 // Depend from config_t size, should be aligned by FLASH_PAGESIZE
 #define SAVE_CONFIG_SIZE        0x00000800
-// Depend from properties_t size, should be aligned by FLASH_PAGESIZE
-#define SAVE_PROP_CONFIG_SIZE   0x00001800
-// Save config_t and properties_t flash area (see flash7  : org = 0x08018000, len = 32k from *.ld settings)
+// Depend from properties_t size (cal data + 112 bytes, checked in flash.c), aligned by FLASH_PAGESIZE
+#define SAVE_PROP_SIZE          (5 * POINTS_COUNT * CAL_VALUE_SIZE + 112)
+#define SAVE_PROP_CONFIG_SIZE   (((SAVE_PROP_SIZE + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE) * FLASH_PAGESIZE)
+// Save slots count, fit in save area (max 7, UI and crc cache limit)
+#if (SAVE_AREA_SIZE - SAVE_CONFIG_SIZE) / SAVE_PROP_CONFIG_SIZE > 7
+#define SAVEAREA_MAX 7
+#else
+#define SAVEAREA_MAX ((SAVE_AREA_SIZE - SAVE_CONFIG_SIZE) / SAVE_PROP_CONFIG_SIZE)
+#endif
 // Properties save area follow after config
-// len = SAVE_CONFIG_SIZE + SAVEAREA_MAX * SAVE_PROP_CONFIG_SIZE   0x00008000  32k
+// len = SAVE_CONFIG_SIZE + SAVEAREA_MAX * SAVE_PROP_CONFIG_SIZE <= SAVE_AREA_SIZE
 #define SAVE_CONFIG_ADDR        0x08018000
 #define SAVE_PROP_CONFIG_ADDR   (SAVE_CONFIG_ADDR + SAVE_CONFIG_SIZE)
 #define SAVE_FULL_AREA_SIZE     (SAVE_CONFIG_SIZE + SAVEAREA_MAX * SAVE_PROP_CONFIG_SIZE)
@@ -785,6 +880,8 @@ void rtc_set_time(uint32_t dr, uint32_t tr);
 #define CONFIG_MAGIC 0x434f4e45 /* 'CONF' */
 
 extern uint16_t lastsaveid;
+// lastsaveid value then calibration not from flash slot (not used for interpolate)
+#define NO_SAVE_SLOT      ((uint16_t)(-1))
 
 #define frequency0 current_props._frequency0
 #define frequency1 current_props._frequency1
@@ -799,6 +896,11 @@ extern uint16_t lastsaveid;
 #define domain_mode current_props._domain_mode
 #define velocity_factor current_props._velocity_factor
 #define marker_smith_format current_props._marker_smith_format
+// Time domain zoom/gate stored in config (not change save slot layout)
+#define td_zoom_start config._td_zoom_start
+#define td_zoom_stop  config._td_zoom_stop
+#define td_gate_start config._td_gate_start
+#define td_gate_stop  config._td_gate_stop
 
 #define previous_marker uistat._previous_marker
 #define current_trace   uistat._current_trace
@@ -809,6 +911,10 @@ extern uint16_t lastsaveid;
 int caldata_save(uint32_t id);
 int caldata_recall(uint32_t id);
 const properties_t *caldata_reference(void);
+const properties_t *caldata_get(uint32_t id);
+uint32_t caldata_checksum(void);
+uint32_t checksum_update(uint32_t value, const void *start, size_t len);
+uint16_t caldata_select(uint32_t start, uint32_t stop);
 
 int config_save(void);
 int config_recall(void);
@@ -826,6 +932,12 @@ void clear_all_config_prop_data(void);
 
 void ui_init(void);
 void ui_process(void);
+void ui_draw_menu(void);
+#ifdef __USE_SD_CARD_LOG__
+// SD card log file (if SWEEP_LOG mode enabled), begin record and append measured point
+void sd_card_log_start(uint16_t mask);
+void sd_card_log_point(uint16_t idx);
+#endif
 
 void handle_touch_interrupt(void);
 
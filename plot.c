@@ -28,6 +28,14 @@
 
 static void cell_draw_marker_info(int x0, int y0);
 static void draw_battery_status(void);
+static void update_grid_x_mask(void);
+
+// Calibration status position (left of plot area) and height (calibration, power, gate lines)
+#define CAL_STATUS_YPOS         100
+#define CAL_STATUS_HEIGHT       (8*FONT_STR_HEIGHT)
+// Battery image position and max height (top 4 + levels with separators + bottom 2 rows)
+#define BATTERY_YPOS            1
+#define BATTERY_HEIGHT          20
 
 static int16_t grid_offset;
 static int16_t grid_width;
@@ -40,24 +48,27 @@ uint16_t sweep_count = 0;
 
 // Cell render use spi buffer
 static pixel_t *cell_buffer;
+// Rendered cell rows count (draw_cell render only dirty rows, all cell rasterizers clip by it)
+static int cell_height = CELLHEIGHT;
 // Check buffer size
-#if CELLWIDTH*CELLHEIGHT > SPI_BUFFER_SIZE
-#error "Too small spi_buffer size SPI_BUFFER_SIZE < CELLWIDTH*CELLHEIGH"
+#if CELLWIDTH*CELLHEIGHT*DISPLAY_CELL_BUFFER_COUNT > SPI_BUFFER_SIZE
+#error "Too small spi_buffer size SPI_BUFFER_SIZE < CELLWIDTH*CELLHEIGH*DISPLAY_CELL_BUFFER_COUNT"
 #endif
 
 // indicate dirty cells (not redraw if cell data not changed)
 #define MAX_MARKMAP_X    ((LCD_WIDTH+CELLWIDTH-1)/CELLWIDTH)
 #define MAX_MARKMAP_Y    ((LCD_HEIGHT+CELLHEIGHT-1)/CELLHEIGHT)
-// Define markmap mask size
-#if MAX_MARKMAP_X <= 8
-typedef uint8_t map_t;
-#elif MAX_MARKMAP_X <= 16
-typedef uint16_t map_t;
-#elif MAX_MARKMAP_X <= 32
-typedef uint32_t map_t;
+// Dirty rows span in cell: rows y0 ... y1-1 need redraw, y1 == 0 - cell not dirty
+// (zero filled map = clean, allow redraw and send to LCD only changed rows of cell)
+typedef struct {
+  uint8_t y0;
+  uint8_t y1;
+} map_t;
+#if CELLHEIGHT > 255
+#error "map_t dirty rows span not fit CELLHEIGHT"
 #endif
 
-static map_t   markmap[2][MAX_MARKMAP_Y];
+static map_t   markmap[2][MAX_MARKMAP_Y][MAX_MARKMAP_X];
 static uint8_t current_mappage = 0;
 
 // Trace data cache, for faster redraw cells
@@ -65,6 +76,16 @@ static uint8_t current_mappage = 0;
 //   CELL_Y[ 0:15] y position
 typedef uint32_t index_t;
 static index_t trace_index[TRACES_MAX][POINTS_COUNT];
+// Trace index cache key, trace index recalculated only if trace settings or channel data changed
+typedef struct {
+  float    scale;
+  float    refpos;
+  uint16_t version;
+  uint16_t points;
+  uint8_t  type;
+  uint8_t  channel;
+} trace_index_key_t;
+static trace_index_key_t trace_index_key[TRACES_MAX];
 
 #define INDEX(x, y) ((((index_t)(x))<<16)|(((index_t)(y))))
 #define CELL_X(i)  ((int)(((i)>>16)))
@@ -101,6 +122,7 @@ void update_grid(void)
 
   grid_offset = (WIDTH) * ((fstart % grid) / 100) / (fspan / 100);
   grid_width = (WIDTH) * (grid / 100) / (fspan / 1000);
+  update_grid_x_mask();
 
   redraw_request |= REDRAW_FREQUENCY|REDRAW_AREA;
 }
@@ -354,6 +376,89 @@ rectangular_grid(int x, int y)
 }
 #endif
 
+#ifdef __USE_GRID_CACHE__
+// Smith/polar grid depend only from P_CENTER_X, P_CENTER_Y, P_RADIUS (constant geometry), so it
+// calculated one time (on first use or change grid type) and copied to cells from cache
+// Grid symmetric by horizontal axis, cache store only rows 0 ... P_RADIUS from center
+#define GRID_CACHE_ROWS    (P_RADIUS + 1)
+#define GRID_CACHE_WIDTH   (2 * P_RADIUS + 1)
+#define GRID_CACHE_X0      (P_CENTER_X - P_RADIUS)
+#ifdef NANOVNA_F303
+// 1 bit per pixel mask (3.7k RAM)
+#define GRID_CACHE_WORDS   ((GRID_CACHE_WIDTH + 31) / 32)
+static uint32_t grid_cache[GRID_CACHE_ROWS][GRID_CACHE_WORDS];
+#else
+// Run-length spans, row span index in grid_cache_row. Polar grid also symmetric by vertical axis,
+// so for it stored only right half (from center), left half mirrored on copy
+// Cache size from measured spans count: Smith 758, polar right half 504 (full 891)
+// 758 * 2 + 118 * 2 = 1752 bytes RAM
+#define GRID_CACHE_SPANS   758
+#if GRID_CACHE_WIDTH > 255
+#error "grid_cache span not fit GRID_CACHE_WIDTH"
+#endif
+static uint16_t grid_cache_row[GRID_CACHE_ROWS + 1];
+static struct {
+  uint8_t x;
+  uint8_t len;
+} grid_cache[GRID_CACHE_SPANS];
+#endif
+// Cached grid type (TRC_SMITH or TRC_POLAR mask), and build result
+static uint8_t grid_cache_type = 0;
+static bool    grid_cache_ok = false;
+
+static void
+grid_cache_build(uint32_t type)
+{
+  int (*grid)(int x, int y) = type == (1 << TRC_SMITH) ? smith_grid : polar_grid;
+  int x, r;
+#ifdef NANOVNA_F303
+  memset(grid_cache, 0, sizeof(grid_cache));
+  for (r = 0; r < GRID_CACHE_ROWS; r++)
+    for (x = 0; x < GRID_CACHE_WIDTH; x++)
+      if (grid(x + GRID_CACHE_X0, P_CENTER_Y - r))
+        grid_cache[r][x >> 5] |= 1U << (x & 31);
+#else
+  uint16_t n = 0;
+  int xb = type == (1 << TRC_POLAR) ? P_RADIUS : 0;
+  for (r = 0; r < GRID_CACHE_ROWS; r++) {
+    grid_cache_row[r] = n;
+    for (x = xb; x < GRID_CACHE_WIDTH; x++) {
+      if (!grid(x + GRID_CACHE_X0, P_CENTER_Y - r))
+        continue;
+      if (n == GRID_CACHE_SPANS) goto overflow;
+      grid_cache[n].x = x;
+      grid_cache[n].len = 0;
+      while (x < GRID_CACHE_WIDTH && grid(x + GRID_CACHE_X0, P_CENTER_Y - r)) {
+        grid_cache[n].len++;
+        x++;
+      }
+      n++;
+    }
+  }
+  grid_cache_row[r] = n;
+#endif
+  grid_cache_type = type;
+  grid_cache_ok = true;
+  return;
+#ifndef NANOVNA_F303
+overflow:
+  // Not fit in cache, use slow per pixel grid render
+  grid_cache_type = type;
+  grid_cache_ok = false;
+#endif
+}
+
+// Return true if grid for trace_type mask ready in cache
+static bool
+grid_cache_check(uint32_t trace_type)
+{
+  uint32_t type = (trace_type & (1 << TRC_SMITH)) ? (1 << TRC_SMITH) : (1 << TRC_POLAR);
+  if (grid_cache_type != type)
+    grid_cache_build(type);
+  return grid_cache_ok;
+}
+#endif
+
 static int
 rectangular_grid_x(int x)
 {
@@ -366,14 +471,17 @@ rectangular_grid_x(int x)
   return 0;
 }
 
-static int
-rectangular_grid_y(int y)
+// Rectangular grid vertical lines position mask (bit by x), cells get lines from it
+static uint32_t grid_x_mask[(AREA_WIDTH_NORMAL + 31) / 32];
+
+static void
+update_grid_x_mask(void)
 {
-  if (y < 0)
-    return 0;
-  if ((y % GRIDY) == 0)
-    return 1;
-  return 0;
+  int x;
+  memset(grid_x_mask, 0, sizeof(grid_x_mask));
+  for (x = 0; x < AREA_WIDTH_NORMAL; x++)
+    if (rectangular_grid_x(x))
+      grid_x_mask[x >> 5] |= 1U << (x & 31);
 }
 
 #if 0
@@ -418,7 +526,7 @@ draw_on_strut(int v0, int d, int color)
 static float
 logmag(const float *v)
 {
-  return log10f(v[0]*v[0] + v[1]*v[1]) * 10;
+  return vna_log10f(v[0]*v[0] + v[1]*v[1]) * 10;
 }
 
 /*
@@ -427,7 +535,7 @@ logmag(const float *v)
 static float
 phase(const float *v)
 {
-  return (180.0f / VNA_PI) * atan2f(v[1], v[0]);
+  return (180.0f / VNA_PI) * vna_atan2f(v[1], v[0]);
 }
 
 /*
@@ -440,7 +548,7 @@ groupdelay(const float *v, const float *w, float deltaf)
   // atan(w)-atan(v) = atan((w-v)/(1+wv))
   float r = w[0]*v[1] - w[1]*v[0];
   float i = w[0]*v[0] + w[1]*v[1];
-  return atan2f(r, i) / (2 * VNA_PI * deltaf);
+  return vna_atan2f(r, i) / (2 * VNA_PI * deltaf);
 #else
   return (atan2f(w[0], w[1]) - atan2f(v[0], v[1])) / (2 * VNA_PI * deltaf);
 #endif
@@ -528,61 +636,52 @@ groupdelay_from_array(int i, float array[POINTS_COUNT][2])
   return groupdelay(array[bottom], array[top], deltaf);
 }
 
-static index_t
-trace_into_index(int t, int i, float array[POINTS_COUNT][2])
-{
-  int y, x;
+// Calculate index for all trace points, value for point i get from expression v
+// x = (i * WIDTH + (sweep_points-1)/2) / (sweep_points-1) + CELLOFFSETX calculated incremental (not use division)
+#define TRACE_INDEX_LOOP(v) \
+  for (i = 0; i < sweep_points; i++) { \
+    float value = refpos - (v) * scale; \
+    if (value <  0) value = 0; \
+    if (value > NGRIDY) value = NGRIDY; \
+    index[i] = INDEX(x, float2int(value * GRIDY)); \
+    x+= x_step; r+= r_step; \
+    if (r >= d) {r-= d; x++;} \
+  }
 
-  float *coeff = array[i];
-  float refpos = NGRIDY - get_trace_refpos(t);
-  float v = 0.0f;
+// Calculate trace index for all points, trace settings get and format select one time for trace
+static void
+trace_into_index(int t, float array[POINTS_COUNT][2])
+{
+  int i, x, y;
+  index_t *index = trace_index[t];
   float scale = 1 / get_trace_scale(t);
-  switch (trace[t].type) {
-  case TRC_LOGMAG:
-    v = logmag(coeff);
-    break;
-  case TRC_PHASE:
-    v = phase(coeff);
-    break;
-  case TRC_DELAY:
-    v = groupdelay_from_array(i, array);
-    break;
-  case TRC_LINEAR:
-    v = linear(coeff);
-    break;
-  case TRC_SWR:
-    v = (swr(coeff) - 1);
-    break;
-  case TRC_REAL:
-    v = real(coeff);
-    break;
-  case TRC_IMAG:
-    v = imag(coeff);
-    break;
-  case TRC_R:
-    v = resistance(coeff);
-    break;
-  case TRC_X:
-    v = reactance(coeff);
-    break;
-  case TRC_Q:
-    v = qualityfactor(coeff);
-    break;
-  case TRC_SMITH:
-  //case TRC_ADMIT:
-  case TRC_POLAR:
-    cartesian_scale(coeff, &x, &y, scale);
-    goto set_index;
-//  default:
-//    return 0;
+  uint32_t type = trace[t].type;
+  if (type == TRC_SMITH || type == TRC_POLAR) {
+    for (i = 0; i < sweep_points; i++) {
+      cartesian_scale(array[i], &x, &y, scale);
+      index[i] = INDEX(x, y);
+    }
+    return;
+  }
+  float refpos = NGRIDY - get_trace_refpos(t);
+  int d = sweep_points - 1;
+  int x_step = WIDTH / d;
+  int r_step = WIDTH % d;
+  int r = d / 2;
+  x = CELLOFFSETX;
+  switch (type) {
+  case TRC_LOGMAG: TRACE_INDEX_LOOP(logmag(array[i]));                 break;
+  case TRC_PHASE:  TRACE_INDEX_LOOP(phase(array[i]));                  break;
+  case TRC_DELAY:  TRACE_INDEX_LOOP(groupdelay_from_array(i, array));  break;
+  case TRC_LINEAR: TRACE_INDEX_LOOP(linear(array[i]));                 break;
+  case TRC_SWR:    TRACE_INDEX_LOOP(swr(array[i]) - 1);                break;
+  case TRC_REAL:   TRACE_INDEX_LOOP(real(array[i]));                   break;
+  case TRC_IMAG:   TRACE_INDEX_LOOP(imag(array[i]));                   break;
+  case TRC_R:      TRACE_INDEX_LOOP(resistance(array[i]));             break;
+  case TRC_X:      TRACE_INDEX_LOOP(reactance(array[i]));              break;
+  case TRC_Q:      TRACE_INDEX_LOOP(qualityfactor(array[i]));          break;
+  default:         TRACE_INDEX_LOOP(0.0f);                             break;
   }
-  v = refpos - v * scale;
-  if (v <  0) v = 0;
-  if (v > NGRIDY) v = NGRIDY;
-  x = (i * (WIDTH) + (sweep_points-1)/2) / (sweep_points-1) + CELLOFFSETX;
-  y = float2int(v * GRIDY);
-set_index:
-  return INDEX(x, y);
 }
 
 static void
@@ -715,20 +814,33 @@ trace_get_info(int t, char *buf, int len)
 
 static float time_of_index(int idx)
 {
+#ifdef __USE_TD_ZOOM__
+  if (TD_ZOOM_ENABLED())
+    return td_zoom_start + idx * (td_zoom_stop - td_zoom_start) / (sweep_points - 1);
+#endif
   return (idx / (float)FFT_SIZE) / (frequencies[1] - frequencies[0]);
 }
 
 static float distance_of_index(int idx)
 {
-  float distance = ((float)(SPEED_OF_LIGHT / (2 * FFT_SIZE))) * idx / (frequencies[1] - frequencies[0]);
+  float distance = ((float)(SPEED_OF_LIGHT / 2)) * time_of_index(idx);
   return distance * velocity_factor;
 }
 
+// Mark rows y0 ... y1 (inclusive) in cell m, n as dirty
 static void
-mark_map(int x, int y)
+mark_map(int m, int n, int y0, int y1)
 {
-  if (y >= 0 && y < MAX_MARKMAP_Y && x >= 0 && x < MAX_MARKMAP_X)
-    markmap[current_mappage][y] |= 1 << x;
+  if (n < 0 || n >= MAX_MARKMAP_Y || m < 0 || m >= MAX_MARKMAP_X)
+    return;
+  map_t *map = &markmap[current_mappage][n][m];
+  if (map->y1 == 0) {
+    map->y0 = y0;
+    map->y1 = y1 + 1;
+    return;
+  }
+  if (map->y0 > y0    ) map->y0 = y0;
+  if (map->y1 < y1 + 1) map->y1 = y1 + 1;
 }
 
 static inline void
@@ -746,20 +858,31 @@ clear_markmap(void)
 void
 force_set_markmap(void)
 {
-  memset(markmap[current_mappage], 0xff, sizeof markmap[current_mappage]);
+  int i;
+  map_t *map = &markmap[current_mappage][0][0];
+  for (i = 0; i < MAX_MARKMAP_X * MAX_MARKMAP_Y; i++) {
+    map[i].y0 = 0;
+    map[i].y1 = CELLHEIGHT;
+  }
 }
 
 void
 invalidate_rect(int x0, int y0, int x1, int y1)
 {
+  if (y0 < 0) y0 = 0;
+  if (y1 < y0) return;
   x0 /= CELLWIDTH;
   x1 /= CELLWIDTH;
-  y0 /= CELLHEIGHT;
-  y1 /= CELLHEIGHT;
-  int x, y;
-  for (y = y0; y <= y1; y++)
-    for (x = x0; x <= x1; x++) 
-      mark_map(x, y);
+  int n0 = y0 / CELLHEIGHT;
+  int n1 = y1 / CELLHEIGHT;
+  int x, n;
+  for (n = n0; n <= n1; n++) {
+    // Dirty rows in cell row
+    int r0 = n == n0 ? y0 - n * CELLHEIGHT : 0;
+    int r1 = n == n1 ? y1 - n * CELLHEIGHT : CELLHEIGHT - 1;
+    for (x = x0; x <= x1; x++)
+      mark_map(x, n, r0, r1);
+  }
 }
 
 #define SWAP(x,y) {int t=x;x=y;y=t;}
@@ -767,26 +890,29 @@ invalidate_rect(int x0, int y0, int x1, int y1)
 static void
 mark_cells_from_index(void)
 {
-  int t, i, j;
-  /* mark cells between each neighbor points */
-  map_t *map = &markmap[current_mappage][0];
+  int t, i;
+  /* mark rows in cells between each neighbor points (line bounding box) */
   for (t = 0; t < TRACES_MAX; t++) {
     if (!trace[t].enabled)
       continue;
     index_t *index = &trace_index[t][0];
-    int m0 = CELL_X(index[0]) / CELLWIDTH;
-    int n0 = CELL_Y(index[0]) / CELLHEIGHT;
-    map[n0] |= 1 << m0;
+    int x0 = CELL_X(index[0]);
+    int y0 = CELL_Y(index[0]);
+    invalidate_rect(x0, y0, x0, y0);
     for (i = 1; i < sweep_points; i++) {
-      int m1 = CELL_X(index[i]) / CELLWIDTH;
-      int n1 = CELL_Y(index[i]) / CELLHEIGHT;
-      if (m0 == m1 && n0 == n1)
+      int x1 = CELL_X(index[i]);
+      int y1 = CELL_Y(index[i]);
+      if (x0 == x1 && y0 == y1)
         continue;
-      int x0 = m0; int x1 = m1; if (x0>x1) SWAP(x0, x1); m0 = m1;
-      int y0 = n0; int y1 = n1; if (y0>y1) SWAP(y0, y1); n0 = n1;
-      for (; y0 <= y1; y0++)
-        for (j = x0; j <= x1; j++)
-          map[y0] |= 1 << j;
+      if (x0 < x1) {
+        if (y0 < y1) invalidate_rect(x0, y0, x1, y1);
+        else         invalidate_rect(x0, y1, x1, y0);
+      } else {
+        if (y0 < y1) invalidate_rect(x1, y0, x0, y1);
+        else         invalidate_rect(x1, y1, x0, y0);
+      }
+      x0 = x1;
+      y0 = y1;
     }
   }
 }
@@ -798,6 +924,18 @@ markmap_upperarea(void)
   invalidate_rect(0, 0, AREA_WIDTH_NORMAL, 3*FONT_STR_HEIGHT);
 }
 
+// Draw horizontal span x0 ... x1 on row y (clipped by cell)
+static inline void
+cell_drawspan(int x0, int x1, int y, pixel_t c)
+{
+  if (y < 0 || y >= cell_height) return;
+  if (x0 < 0) x0 = 0;
+  if (x1 >= CELLWIDTH) x1 = CELLWIDTH - 1;
+  pixel_t *buf = &cell_buffer[y * CELLWIDTH];
+  for (; x0 <= x1; x0++)
+    buf[x0] |= c;
+}
+
 //
 // in most cases _compute_outcode clip calculation not give render line speedup
 //
@@ -807,22 +945,26 @@ cell_drawline(int x0, int y0, int x1, int y1, pixel_t c)
   if (x0 < 0 && x1 < 0) return;
   if (y0 < 0 && y1 < 0) return;
   if (x0 >= CELLWIDTH && x1 >= CELLWIDTH) return;
-  if (y0 >= CELLHEIGHT && y1 >= CELLHEIGHT) return;
+  if (y0 >= cell_height && y1 >= cell_height) return;
 
   // modifed Bresenham's line algorithm, see https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+  // pixels on one row collected in horizontal span and drawn at once (clip only spans, not every pixel)
   if (x1 < x0) { SWAP(x0, x1); SWAP(y0, y1); }
   int dx =-(x1 - x0);
   int dy = (y1 - y0), sy = 1; if (dy < 0) { dy = -dy; sy = -1; }
   int err = ((dy + dx) < 0 ? -dx : -dy) / 2;
-  while (1) {
-    if (y0 >= 0 && y0 < CELLHEIGHT && x0 >= 0 && x0 < CELLWIDTH)
-      cell_buffer[y0 * CELLWIDTH + x0] |= c;
-    if (x0 == x1 && y0 == y1)
-      return;
+  int xs = x0;
+  while (x0 != x1 || y0 != y1) {
     int e2 = err;
+    if (e2 < dy) cell_drawspan(xs, x0, y0, c); // row change, draw current row span
     if (e2 > dx) { err-= dy; x0++;  }
-    if (e2 < dy) { err-= dx; y0+=sy;}
+    if (e2 < dy) {
+      err-= dx; y0+=sy; xs = x0;
+      // next rows all outside cell
+      if (sy > 0 ? y0 >= cell_height : y0 < 0) return;
+    }
   }
+  cell_drawspan(xs, x0, y0, c);
 }
 
 // Give a little speedup then draw rectangular plot (50 systick on all calls, all render req 700 systick)
@@ -872,14 +1014,14 @@ search_index_range_x(int x1, int x2, index_t index[POINTS_COUNT], int *i0, int *
 static void
 cell_blit_bitmap(int x, int y, uint16_t w, uint16_t h, const uint8_t *bmp)
 {
-  if (x <= -w)
+  if (x <= -w || y <= -h || y >= cell_height)
     return;
   uint8_t bits = 0;
   int c = h+y, r;
   for (; y < c; y++) {
     for (r = 0; r < w; r++) {
       if ((r&7)==0) bits = *bmp++;
-      if (y >= 0 && x+r >= 0 && y < CELLHEIGHT && x+r < CELLWIDTH && (0x80 & bits))
+      if (y >= 0 && x+r >= 0 && y < cell_height && x+r < CELLWIDTH && (0x80 & bits))
         cell_buffer[y*CELLWIDTH + x + r] = foreground_color;
       bits <<= 1;
     }
@@ -889,7 +1031,7 @@ cell_blit_bitmap(int x, int y, uint16_t w, uint16_t h, const uint8_t *bmp)
 static void
 cell_drawstring(char *str, int x, int y)
 {
-  if (y <= -FONT_GET_HEIGHT || y >= CELLHEIGHT)
+  if (y <= -FONT_GET_HEIGHT || y >= cell_height)
     return;
   while (*str) {
     if (x >= CELLWIDTH)
@@ -1185,14 +1327,24 @@ search_nearest_index(int x, int y, int t)
 void
 plot_into_index(float measured[2][POINTS_COUNT][2])
 {
-  int t, i;
+  int t;
   for (t = 0; t < TRACES_MAX; t++) {
     if (!trace[t].enabled)
       continue;
     int ch = trace[t].channel;
-    index_t *index = trace_index[t];
-    for (i = 0; i < sweep_points; i++)
-      index[i] = trace_into_index(t, i, measured[ch]);
+    trace_index_key_t *key = &trace_index_key[t];
+    // Trace data and settings not changed, use cached index
+    if (key->version == measured_version[ch] && key->points  == sweep_points &&
+        key->type    == trace[t].type        && key->channel == ch           &&
+        key->scale   == get_trace_scale(t)   && key->refpos  == get_trace_refpos(t))
+      continue;
+    key->version = measured_version[ch];
+    key->points  = sweep_points;
+    key->type    = trace[t].type;
+    key->channel = ch;
+    key->scale   = get_trace_scale(t);
+    key->refpos  = get_trace_refpos(t);
+    trace_into_index(t, measured[ch]);
   }
 
   // Marker track on data update
@@ -1204,13 +1356,88 @@ plot_into_index(float measured[2][POINTS_COUNT][2])
   markmap_all_markers();
 }
 
+// Cell render output redirect (if set, cell data send to it instead of LCD)
+static void (*cell_render_out)(int x, int y, int w, int h, pixel_t *buf) = NULL;
+
+// Draw rectangular grid in cell: vertical lines from mask, horizontal lines every GRIDY rows
+static void
+cell_draw_rectangular_grid(int x0, int y0, int w, int h, pixel_t c)
+{
+  int x, y;
+  // vertical lines
+  for (x = 0; x < w; x++) {
+    uint32_t bits = grid_x_mask[(x + x0) >> 5] >> ((x + x0) & 31);
+    if (bits == 0) {x+= 31 - ((x + x0) & 31); continue;} // skip empty word
+    if (bits & 1) {
+      pixel_t *buf = &cell_buffer[x];
+      for (y = 0; y < h; y++, buf += CELLWIDTH) *buf = c;
+    }
+  }
+  // horizontal lines span (clip by grid area)
+  int xb = CELLOFFSETX - x0;
+  int xe = CELLOFFSETX + WIDTH + 1 - x0;
+  if (xb < 0) xb = 0;
+  if (xe > w) xe = w;
+  if (xb >= xe) return;
+  // First grid line in cell
+  for (y = (y0 + GRIDY - 1) / GRIDY * GRIDY - y0; y < h; y += GRIDY) {
+    pixel_t *buf = &cell_buffer[y * CELLWIDTH];
+    for (x = xb; x < xe; x++) buf[x] = c;
+  }
+}
+
+#ifdef __USE_GRID_CACHE__
+// Copy cached Smith/polar grid to cell
 static void
-draw_cell(int m, int n)
+cell_draw_grid_cache(int x0, int y0, int w, int h, pixel_t c)
+{
+  int x, y;
+  // Cache x position of cell left column
+  int xs = x0 - GRID_CACHE_X0;
+  for (y = 0; y < h; y++) {
+    int r = y + y0 - P_CENTER_Y;
+    if (r < 0) r = -r;
+    if (r >= GRID_CACHE_ROWS) continue;
+    pixel_t *buf = &cell_buffer[y * CELLWIDTH];
+#ifdef NANOVNA_F303
+    int xb = xs < 0 ? -xs : 0;
+    int xe = GRID_CACHE_WIDTH - xs < w ? GRID_CACHE_WIDTH - xs : w;
+    const uint32_t *row = grid_cache[r];
+    for (x = xb; x < xe; x++) {
+      int cx = xs + x;
+      uint32_t bits = row[cx >> 5] >> (cx & 31);
+      if (bits == 0) {x+= 31 - (cx & 31); continue;} // skip empty word
+      if (bits & 1) buf[x] = c;
+    }
+#else
+    int i, k;
+    for (i = grid_cache_row[r]; i < grid_cache_row[r + 1]; i++) {
+      int len = grid_cache[i].len;
+      int xb = grid_cache[i].x;
+      // Polar grid: right half span and mirrored left half span
+      for (k = grid_cache_type == (1 << TRC_POLAR) ? 2 : 1; k--; xb = 2 * P_RADIUS + 1 - xb - len) {
+        int xe = xb - xs + len;
+        x = xb - xs;
+        if (xe <= 0 || x >= w) continue;
+        if (x < 0) x = 0;
+        if (xe > w) xe = w;
+        for (; x < xe; x++)
+          buf[x] = c;
+      }
+    }
+#endif
+  }
+}
+#endif
+
+// Render rows row0 ... row1-1 of cell m, n (only this rows cleared, rendered and send to LCD)
+static void
+draw_cell(int m, int n, int row0, int row1)
 {
   int x0 = m * CELLWIDTH;
-  int y0 = n * CELLHEIGHT;
+  int y0 = n * CELLHEIGHT + row0;
   int w = CELLWIDTH;
-  int h = CELLHEIGHT;
+  int h = row1 - row0;
   int x, y;
   int i0, i1, i;
   int t;
@@ -1224,6 +1451,8 @@ draw_cell(int m, int n)
     return;
 //  PULSE;
   cell_buffer = ili9341_get_cell_buffer();
+  // Traces, markers and text clipped by rendered rows (not write outside h rows of buffer)
+  cell_height = h;
   // Clear buffer ("0 : height" lines)
 #if 0
   // use memset 350 system ticks for all screen calls
@@ -1276,20 +1505,14 @@ draw_cell(int m, int n)
     }
   }
   // Draw rectangular plot (40 system ticks for all screen calls)
-  if (trace_type & RECTANGULAR_GRID_MASK) {
-    for (x = 0; x < w; x++) {
-      if (rectangular_grid_x(x + x0)) {
-        for (y = 0; y < h; y++) cell_buffer[y * CELLWIDTH + x] = c;
-      }
-    }
-    for (y = 0; y < h; y++) {
-      if (rectangular_grid_y(y + y0)) {
-        for (x = 0; x < w; x++)
-          if (x + x0 >= CELLOFFSETX && x + x0 <= WIDTH + CELLOFFSETX)
-            cell_buffer[y * CELLWIDTH + x] = c;
-      }
-    }
-  }
+  if (trace_type & RECTANGULAR_GRID_MASK)
+    cell_draw_rectangular_grid(x0, y0, w, h, c);
+#ifdef __USE_GRID_CACHE__
+  // Smith/polar grid from cache
+  if ((trace_type & ((1 << TRC_SMITH) | (1 << TRC_POLAR))) && grid_cache_check(trace_type))
+    cell_draw_grid_cache(x0, y0, w, h, c);
+  else
+#endif
   // Smith greed line (1000 system ticks for all screen calls)
   if (trace_type & (1 << TRC_SMITH)) {
     for (y = 0; y < h; y++)
@@ -1336,6 +1559,18 @@ draw_cell(int m, int n)
       int y1 = CELL_Y(index[i]) - y0;
       int x2 = CELL_X(index[i + 1]) - x0;
       int y2 = CELL_Y(index[i + 1]) - y0;
+      // Points on one x column (sweep points > WIDTH), draw only min/max span (peaks not lost)
+      if (x1 == x2) {
+        int ymin = y1 < y2 ? y1 : y2;
+        int ymax = y1 < y2 ? y2 : y1;
+        for (; i + 1 < i1 && CELL_X(index[i + 2]) - x0 == x1; i++) {
+          y2 = CELL_Y(index[i + 2]) - y0;
+          if (ymin > y2) ymin = y2;
+          if (ymax < y2) ymax = y2;
+        }
+        cell_drawline(x1, ymin, x1, ymax, c);
+        continue; // next line from last column point
+      }
       cell_drawline(x1, y1, x2, y2, c);
     }
   }
@@ -1358,7 +1593,7 @@ draw_cell(int m, int n)
       int y = CELL_Y(index) - y0 - Y_MARKER_OFFSET;
       // Check marker icon on cell
       if (x + MARKER_WIDTH >= 0 && x - MARKER_WIDTH < CELLWIDTH &&
-          y + MARKER_HEIGHT >= 0 && y - MARKER_HEIGHT < CELLHEIGHT){
+          y + MARKER_HEIGHT >= 0 && y - MARKER_HEIGHT < cell_height){
 //        draw_marker(x, y, config.trace_color[t], i);
           // Draw marker plate
           ili9341_set_foreground(LCD_TRACE_1_COLOR + t);
@@ -1392,7 +1627,7 @@ draw_cell(int m, int n)
     int x = 0 - x0 + CELLOFFSETX - REFERENCE_X_OFFSET;
     if (x + REFERENCE_WIDTH >= 0 && x - REFERENCE_WIDTH < CELLWIDTH) {
       int y = HEIGHT - float2int((get_trace_refpos(t) * GRIDY)) - y0 - REFERENCE_Y_OFFSET;
-      if (y + REFERENCE_HEIGHT >= 0 && y - REFERENCE_HEIGHT < CELLHEIGHT){
+      if (y + REFERENCE_HEIGHT >= 0 && y - REFERENCE_HEIGHT < cell_height){
         ili9341_set_foreground(LCD_TRACE_1_COLOR + t);
         cell_blit_bitmap(x , y, REFERENCE_WIDTH, REFERENCE_HEIGHT, reference_bitmap);
       }
@@ -1408,6 +1643,11 @@ draw_cell(int m, int n)
         *dst++ = *src++;
   }
 #endif
+  // Send cell to render output (capture)
+  if (cell_render_out) {
+    cell_render_out(OFFSETX + x0, OFFSETY + y0, w, h, cell_buffer);
+    return;
+  }
   // Draw cell (500 system ticks for all screen calls)
   ili9341_bulk_continue(OFFSETX + x0, OFFSETY + y0, w, h);
 }
@@ -1418,14 +1658,21 @@ draw_all_cells(bool flush_markmap)
   int m, n;
 //  START_PROFILE
   for (m = 0; m < (area_width+CELLWIDTH-1) / CELLWIDTH; m++)
-    for (n = 0; n < (area_height+CELLHEIGHT-1) / CELLHEIGHT; n++)
-      if ((markmap[0][n] | markmap[1][n]) & (1 << m))
-        draw_cell(m, n);
+    for (n = 0; n < (area_height+CELLHEIGHT-1) / CELLHEIGHT; n++) {
+      // Join dirty rows from current and previous map
+      map_t *m0 = &markmap[0][n][m];
+      map_t *m1 = &markmap[1][n][m];
+      if (m0->y1 == 0 && m1->y1 == 0)
+        continue;
+      int row0 = m0->y1 == 0 ? m1->y0 : (m1->y1 == 0 || m0->y0 < m1->y0 ? m0->y0 : m1->y0);
+      int row1 = m0->y1 > m1->y1 ? m0->y1 : m1->y1;
+      draw_cell(m, n, row0, row1);
+    }
 #if 0
   ili9341_bulk_finish();
   for (m = 0; m < (area_width+CELLWIDTH-1) / CELLWIDTH; m++)
     for (n = 0; n < (area_height+CELLHEIGHT-1) / CELLHEIGHT; n++) {
-      if ((markmap[0][n] | markmap[1][n]) & (1 << m))
+      if (markmap[0][n][m].y1 | markmap[1][n][m].y1)
         ili9341_set_background(LCD_LOW_BAT_COLOR);
       else
         ili9341_set_background(LCD_NORMAL_BAT_COLOR);
@@ -1443,6 +1690,50 @@ draw_all_cells(bool flush_markmap)
 //  STOP_PROFILE
 }
 
+// Render all cells and send data to out function (LCD not used, allow capture without LCD read)
+void
+render_all_cells(void (*out)(int x, int y, int w, int h, pixel_t *buf))
+{
+  int m, n;
+  // Cell buffer can be used by LCD DMA transfer
+  ili9341_bulk_finish();
+  cell_render_out = out;
+  for (m = 0; m < (area_width+CELLWIDTH-1) / CELLWIDTH; m++)
+    for (n = 0; n < (area_height+CELLHEIGHT-1) / CELLHEIGHT; n++)
+      draw_cell(m, n, 0, CELLHEIGHT);
+  cell_render_out = NULL;
+}
+
+// Render screen rows y ... y + h - 1 to buf (LCD_WIDTH pixels per row), LCD not used
+// (screenshot without LCD read). Render plot cells, status, frequencies and menu if shown
+// Status parts drawn only on rows intersect it (all LCD output clipped by rows, text and
+// bitmaps drawn direct to rows). Keypad and numeric input not rendered
+#define ROWS_INTERSECT(y, h, y0, h0)  ((y) < (y0) + (h0) && (y0) < (y) + (h))
+void
+render_screen_rows(int y, int h, pixel_t *buf)
+{
+  int m, n = (y - OFFSETY) / CELLHEIGHT;
+  // Cell buffer can be used by LCD DMA transfer
+  ili9341_bulk_finish();
+  ili9341_set_render_target(buf, y, h);
+  ili9341_set_background(LCD_BG_COLOR);
+  ili9341_fill(0, y, LCD_WIDTH, h);
+  // Rows in plot area, render only this rows of cells
+  if (y >= OFFSETY && y - OFFSETY < area_height) {
+    int row = y - OFFSETY - n * CELLHEIGHT;
+    for (m = 0; m < (area_width+CELLWIDTH-1) / CELLWIDTH; m++)
+      draw_cell(m, n, row, row + h);
+  }
+  if (ROWS_INTERSECT(y, h, FREQUENCIES_YPOS, FONT_GET_HEIGHT))
+    draw_frequencies();
+  if (ROWS_INTERSECT(y, h, CAL_STATUS_YPOS, CAL_STATUS_HEIGHT))
+    draw_cal_status();
+  if (ROWS_INTERSECT(y, h, BATTERY_YPOS, BATTERY_HEIGHT))
+    draw_battery_status();
+  ui_draw_menu();
+  ili9341_set_render_target(NULL, 0, 0);
+}
+
 void
 draw_all(bool flush)
 {
@@ -1639,7 +1930,7 @@ draw_frequencies(void)
       plot_printf(buf2, sizeof(buf2), " SPAN %qHz", get_sweep_frequency(ST_SPAN));
     }
   } else {
-    plot_printf(buf1, sizeof(buf1), " START 0s");
+    plot_printf(buf1, sizeof(buf1), " START %Fs", time_of_index(0));
     plot_printf(buf2, sizeof(buf2), "STOP %Fs (%Fm)", time_of_index(sweep_points-1), distance_of_index(sweep_points-1));
   }
   ili9341_set_foreground(LCD_FG_COLOR);
@@ -1660,15 +1951,16 @@ void
 draw_cal_status(void)
 {
   int x = 0;
-  int y = 100;
+  int y = CAL_STATUS_YPOS;
   char c[3];
   ili9341_set_foreground(LCD_FG_COLOR);
   ili9341_set_background(LCD_BG_COLOR);
-  ili9341_fill(0, y, OFFSETX, 7*(FONT_STR_HEIGHT));
+  ili9341_fill(0, y, OFFSETX, CAL_STATUS_HEIGHT);
   c[2] = 0;
   if (cal_status & CALSTAT_APPLY) {
     c[0] = cal_status & CALSTAT_INTERPOLATED ? 'c' : 'C';
-    c[1] = active_props == &current_props ? '*' : '0' + lastsaveid;
+    // Show source slot also for interpolated from slot calibration
+    c[1] = (active_props == &current_props && !(cal_status & CALSTAT_INTERPOLATED)) || lastsaveid >= SAVEAREA_MAX ? '*' : '0' + lastsaveid;
     ili9341_drawstring(c, x, y);
   }
   uint16_t i;
@@ -1691,6 +1983,13 @@ draw_cal_status(void)
   c[0] = 'P';
   c[1] = current_props._power > 3 ? ('a') : (current_props._power * 2 + '2'); // 2,4,6,8 mA power or auto
   ili9341_drawstring(c, x, y+=FONT_STR_HEIGHT);
+#ifdef __USE_TD_GATE__
+  // Time gate applied to measured data
+  if (TD_GATE_ENABLED()) {
+    ili9341_set_foreground(LCD_FG_COLOR);
+    ili9341_drawstring("G", x, y+=FONT_STR_HEIGHT);
+  }
+#endif
 }
 
 // Draw battery level
@@ -1727,7 +2026,7 @@ static void draw_battery_status(void)
   string_buf[x++] = 0b10000001;
   string_buf[x++] = 0b11111111;
   // Draw battery
-  ili9341_blitBitmap(1, 1, 8, x, string_buf);
+  ili9341_blitBitmap(1, BATTERY_YPOS, 8, x, string_buf);
 }
 
 void
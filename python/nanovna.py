@@ -203,6 +203,46 @@ class NanoVNA:
         self.resume()
         return (array0, array1)
     
+    def capture_rle(self):
+        from PIL import Image
+        import io
+        self.send_command("capture rle\r")
+        # BMP headers, compression: 1 = RLE8, 3 = raw 16bpp (screen have not palette colors)
+        b = bytearray(self.serial.read(14 + 40))
+        offset = struct.unpack_from("<I", b, 10)[0]
+        compression, size = struct.unpack_from("<II", b, 30)
+        if compression != 1:
+            b += self.serial.read(offset - len(b) + size)
+            return Image.open(io.BytesIO(bytes(b)))
+        # palette, after RLE8 data up to end of bitmap code
+        b += self.serial.read(offset - len(b))
+        while True:
+            code = self.serial.read(2)
+            b += code
+            if code[0] == 0:
+                if code[1] == 1:
+                    break
+                if code[1] > 2:
+                    b += self.serial.read(code[1] + (code[1] & 1))
+        # set file and bitmap size
+        struct.pack_into("<I", b, 2, len(b))
+        struct.pack_into("<I", b, 34, len(b) - offset)
+        return Image.open(io.BytesIO(bytes(b)))
+
+    def capture_cells(self):
+        from PIL import Image
+        # render plot area cells on device, not read LCD (menu and frequency area not rendered)
+        self.send_command("capture cells\r")
+        img = Image.new('RGB', (320, 240))
+        while True:
+            x, y, w, h = struct.unpack("<4H", self.serial.read(8))
+            if w == 0 or h == 0:
+                break
+            arr = np.array(struct.unpack(">%dH" % (w * h), self.serial.read(w * h * 2)), dtype=np.uint32)
+            arr = 0xFF000000 + ((arr & 0xF800) >> 8) + ((arr & 0x07E0) << 5) + ((arr & 0x001F) << 19)
+            img.paste(Image.frombuffer('RGBA', (w, h), arr, 'raw', 'RGBA', 0, 1), (x, y))
+        return img
+
     def capture(self):
         from PIL import Image
         self.send_command("capture\r")
@@ -367,6 +407,12 @@ if __name__ == '__main__':
                       help="verbose output")
     parser.add_option("-C", "--capture", dest="capture",
                       help="capture current display to FILE", metavar="FILE")
+    parser.add_option("-R", "--rle", dest="rle",
+                      action="store_true", default=False,
+                      help="capture use RLE compressed transfer")
+    parser.add_option("-r", "--render", dest="render",
+                      action="store_true", default=False,
+                      help="capture plot area rendered by device (not LCD read)")
     parser.add_option("-e", dest="command", action="append",
                       help="send raw command", metavar="COMMAND")
     parser.add_option("-o", dest="save",
@@ -381,7 +427,10 @@ if __name__ == '__main__':
 
     if opt.capture:
         print("capturing...")
-        img = nv.capture()
+        if opt.render:
+            img = nv.capture_cells()
+        else:
+            img = nv.capture_rle() if opt.rle else nv.capture()
         img.save(opt.capture)
         exit(0)
 
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# Convert NanoVNA SD card sweep log (*.log, SD CARD -> LOG SWEEP) to Touchstone files
+import struct
+import sys
+import os
+from optparse import OptionParser
+
+SWEEP_LOG_MAGIC = 0x474C4E56
+# magic, header_size, record_size, seq, date, time, systime, points, mask, reserved
+HEADER = struct.Struct('<IHHIIIIHHI')
+# frequency, S11 re/im, S21 re/im
+POINT = struct.Struct('<Iffff')
+
+def read_log(f):
+    while True:
+        head = f.read(HEADER.size)
+        if len(head) < HEADER.size:
+            return
+        magic, header_size, record_size, seq, date, time, systime, points, mask, _ = HEADER.unpack(head)
+        if magic != SWEEP_LOG_MAGIC:
+            raise ValueError("bad record magic at offset %d" % (f.tell() - HEADER.size))
+        body = f.read(record_size - HEADER.size)
+        body = body[header_size - HEADER.size:]
+        data = [POINT.unpack_from(body, i * POINT.size) for i in range(points)]
+        # frequency = 0: point not measured (sweep restarted before record end)
+        data = [d for d in data if d[0] != 0]
+        yield dict(seq=seq, date=date, time=time, systime=systime, mask=mask, data=data)
+
+def timestamp(rec):
+    d, t = rec['date'], rec['time']
+    return "20%02d-%02d-%02d %02d:%02d:%02d" % ((d >> 16) & 0xFF, (d >> 8) & 0xFF, d & 0xFF,
+                                                (t >> 16) & 0xFF, (t >> 8) & 0xFF, t & 0xFF)
+
+def write_touchstone(filename, rec, s2p):
+    with open(filename, 'w') as f:
+        f.write("!File created by NanoVNA (sweep log record %d, %s)\n" % (rec['seq'], timestamp(rec)))
+        f.write("# Hz S RI R 50\n")
+        for freq, s11r, s11i, s21r, s21i in rec['data']:
+            if s2p:
+                f.write("%10u % f % f % f % f 0 0 0 0\n" % (freq, s11r, s11i, s21r, s21i))
+            else:
+                f.write("%10u % f % f\n" % (freq, s11r, s11i))
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="%prog [options] file.log")
+    parser.add_option("-o", "--output", dest="prefix",
+                      help="output file prefix (default: log file name)", metavar="PREFIX")
+    parser.add_option("-1", "--s1p", dest="s1p", action="store_true", default=False,
+                      help="write .s1p files (S11 only)")
+    parser.add_option("-n", "--record", dest="record", type="int", default=None,
+                      help="convert only record N", metavar="N")
+    (opt, args) = parser.parse_args()
+    if len(args) != 1:
+        parser.print_help()
+        sys.exit(1)
+    prefix = opt.prefix or os.path.splitext(args[0])[0]
+    with open(args[0], 'rb') as f:
+        for rec in read_log(f):
+            if opt.record is not None and rec['seq'] != opt.record:
+                continue
+            # write s2p only if S21 was measured
+            s2p = not opt.s1p and (rec['mask'] & 2) != 0
+            name = "%s_%05d.s%dp" % (prefix, rec['seq'], 2 if s2p else 1)
+            write_touchstone(name, rec, s2p)
+            print("%s  %s  %d points" % (name, timestamp(rec), len(rec['data'])))
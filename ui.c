@@ -25,6 +25,7 @@
 #include "nanovna.h"
 #include "si5351.h"
 #include <string.h>
+#include <math.h>
 
 uistat_t uistat = {
 // digit: 6,
@@ -72,6 +73,11 @@ static FATFS *fs_volume   = (FATFS *)(((uint8_t*)(&spi_buffer[SPI_BUFFER_SIZE]))
 static FIL   *fs_file     = (   FIL*)(((uint8_t*)(&spi_buffer[SPI_BUFFER_SIZE])) - sizeof(FATFS) - sizeof(FIL));
 // Filename object (at the end of spi_buffer)
 static char  *fs_filename = (  char*)(((uint8_t*)(&spi_buffer[SPI_BUFFER_SIZE])) - sizeof(FATFS) - sizeof(FIL) - FF_LFN_BUF - 4);
+// Max formatted text line size (fs_buffer have this free space after FS_BUFFER_SIZE)
+#define FS_LINE_MAX     128
+// Sector aligned write buffer (at the begin of spi_buffer, free space before fs_filename)
+#define FS_BUFFER_SIZE  ((SPI_BUFFER_SIZE*sizeof(pixel_t) - sizeof(FATFS) - sizeof(FIL) - FF_LFN_BUF - 4 - FS_LINE_MAX)&~(FF_MAX_SS-1))
+static uint8_t *fs_buffer = (uint8_t *)spi_buffer;
 #endif
 #endif
 
@@ -82,7 +88,17 @@ enum {
 // Keypad structures
 // Enum for keypads_list
 enum {
-  KM_START, KM_STOP, KM_CENTER, KM_SPAN, KM_CW, KM_SCALE, KM_REFPOS, KM_EDELAY, KM_VELOCITY_FACTOR, KM_SCALEDELAY, KM_NONE
+  KM_START, KM_STOP, KM_CENTER, KM_SPAN, KM_CW, KM_SCALE, KM_REFPOS, KM_EDELAY, KM_VELOCITY_FACTOR, KM_SCALEDELAY,
+#ifdef __USE_SD_CARD_CAL__
+  KM_SD_CAL_SAVE, KM_SD_CAL_LOAD,
+#endif
+#ifdef __USE_TD_ZOOM__
+  KM_TD_ZOOM_START, KM_TD_ZOOM_STOP,
+#endif
+#ifdef __USE_TD_GATE__
+  KM_TD_GATE_START, KM_TD_GATE_STOP,
+#endif
+  KM_NONE
 };
 
 typedef struct {
@@ -634,10 +650,34 @@ static UI_FUNCTION_ADV_CALLBACK(menu_cal_apply_acb)
   draw_cal_status();
 }
 
+static UI_FUNCTION_ADV_CALLBACK(menu_cal_auto_acb)
+{
+  (void)data;
+  if (b){
+    b->icon = (config._mode&VNA_MODE_AUTO_CAL) ? BUTTON_ICON_CHECK : BUTTON_ICON_NOCHECK;
+    return;
+  }
+  config._mode ^= VNA_MODE_AUTO_CAL;
+  draw_menu();
+}
+
+// Slot info for save/recall buttons (frequency range from slot header)
+static const char *
+get_slot_info(uint32_t id)
+{
+  static char info[24];
+  const properties_t *p = caldata_get(id);
+  if (p == NULL)
+    return "EMPTY";
+  plot_printf(info, sizeof(info), "%.0F-%.0F", (float)p->_frequency0, (float)p->_frequency1);
+  return info;
+}
+
 static UI_FUNCTION_ADV_CALLBACK(menu_recall_acb)
 {
   if (b){
     b->p1.i = data;
+    b->p2.text = get_slot_info(data);
     return;
   }
   load_properties(data);
@@ -685,9 +725,14 @@ static UI_FUNCTION_ADV_CALLBACK(menu_save_acb)
 {
   if (b){
     b->p1.u = data;
+    b->p2.text = get_slot_info(data);
     return;
   }
-  if (caldata_save(data) == 0) {
+  // Show message while write flash
+  drawMessageBox("SAVE", "  Saving...", 0);
+  int res = caldata_save(data);
+  request_to_redraw_grid();
+  if (res == 0) {
     menu_move_back(true);
     draw_cal_status();
   }
@@ -1100,28 +1145,262 @@ static UI_FUNCTION_CALLBACK(menu_brightness_cb)
 #endif
 
 #ifdef __USE_SD_CARD__
+//*******************************************************************************************
+// Buffered file write, data collected in fs_buffer and written by full sectors
+//*******************************************************************************************
+static uint16_t fs_buffer_pos;
+
+// Write all data from buffer (call before file close)
+static FRESULT fs_buffer_flush(void)
+{
+  UINT size;
+  FRESULT res = FR_OK;
+  if (fs_buffer_pos)
+    res = f_write(fs_file, fs_buffer, fs_buffer_pos, &size);
+  fs_buffer_pos = 0;
+  return res;
+}
+
+// Accept len bytes placed at fs_buffer_pos (len <= FS_LINE_MAX), write buffer if full
+static FRESULT fs_buffer_commit(uint16_t len)
+{
+  UINT size;
+  FRESULT res = FR_OK;
+  fs_buffer_pos+= len;
+  if (fs_buffer_pos >= FS_BUFFER_SIZE) {
+    res = f_write(fs_file, fs_buffer, FS_BUFFER_SIZE, &size);
+    // Move tail to buffer begin
+    fs_buffer_pos-= FS_BUFFER_SIZE;
+    memmove(fs_buffer, &fs_buffer[FS_BUFFER_SIZE], fs_buffer_pos);
+  }
+  return res;
+}
+
+// Mount SD card volume (if sweep log active, use its volume, remount break log file)
+static FRESULT sd_card_mount(void)
+{
+#ifdef __USE_SD_CARD_LOG__
+  if (sweep_mode & SWEEP_LOG)
+    return FR_OK;
+#endif
+  return f_mount(fs_volume, "", 1);
+}
+
+#ifdef __USE_SD_CARD_LOG__
+//*******************************************************************************************
+// Sweep logger: append every completed sweep to binary log file
+// Record = header + points * (frequency, S11 re/im, S21 re/im), zero padded to sector size
+// (use python/vnalog2touchstone.py for convert)
+// Volume mounted and file opened once on log start, record header written on sweep start
+// and points appended as measured (calibration applied on every point), FatFs sector
+// buffer collect data and full sector written to card on next append in sweep delay
+//*******************************************************************************************
+#if APPLY_CALIBRATION_AFTER_SWEEP
+#error "Sweep log need calibrated data on every point, set APPLY_CALIBRATION_AFTER_SWEEP 0"
+#endif
+#define SWEEP_LOG_MAGIC  0x474C4E56  // "VNLG"
+// Update file size in directory every SWEEP_LOG_SYNC records (limit data lost on power off)
+#define SWEEP_LOG_SYNC   16
+typedef struct {
+  uint32_t magic;
+  uint16_t header_size;     // sizeof(sweep_log_header_t)
+  uint16_t record_size;     // full record size (aligned to sector)
+  uint32_t seq;             // record number
+  uint32_t date;            // rtc_get_dr_bin() 0x00YYMMDD
+  uint32_t time;            // rtc_get_tr_bin() 0x00HHMMSS
+  uint32_t systime;         // system ticks (10 ticks = 1ms)
+  uint16_t points;
+  uint16_t mask;            // measured channels mask (bit 0 = S11, bit 1 = S21)
+  uint32_t reserved;
+} sweep_log_header_t;
+
+typedef struct {
+  uint32_t freq;            // 0 if point not measured (sweep restarted)
+  float data[2][2];
+} sweep_log_point_t;
+
+// Log volume and file object used between sweeps, so can`t be placed in spi_buffer
+static FATFS log_volume;
+static FIL   log_file;
+static uint32_t log_seq;
+static uint16_t log_points;  // points in current record (0 - record not started)
+static uint16_t log_index;   // next point for write
+
+static FRESULT sd_card_log_write(const void *data, UINT len)
+{
+  UINT size;
+  FRESULT res = f_write(&log_file, data, len, &size);
+  // Disk full
+  if (res == FR_OK && size != len)
+    res = FR_DENIED;
+  return res;
+}
+
+// Fill not measured points by zero, and pad record to sector size
+static FRESULT sd_card_log_end_record(void)
+{
+  sweep_log_point_t p;
+  FRESULT res = FR_OK;
+  memset(&p, 0, sizeof(p));
+  for (; log_index < log_points && res == FR_OK; log_index++)
+    res = sd_card_log_write(&p, sizeof(p));
+  while (res == FR_OK) {
+    UINT len = (FF_MAX_SS - f_tell(&log_file))&(FF_MAX_SS-1);
+    if (len == 0)
+      break;
+    res = sd_card_log_write(&p, len > sizeof(p) ? sizeof(p) : len);
+  }
+  log_points = 0;
+  return res;
+}
+
+static void sd_card_log_stop(void)
+{
+  if (log_points)
+    sd_card_log_end_record();
+  f_close(&log_file);
+  sweep_mode&=~SWEEP_LOG;
+}
+
+// Called from sweep on first point, begin new record
+void sd_card_log_start(uint16_t mask)
+{
+  sweep_log_header_t header;
+  FRESULT res = FR_OK;
+  // Sweep restarted before end, complete previous record
+  if (log_points)
+    res = sd_card_log_end_record();
+  if (res == FR_OK && log_seq && (log_seq % SWEEP_LOG_SYNC) == 0)
+    res = f_sync(&log_file);
+  header.magic       = SWEEP_LOG_MAGIC;
+  header.header_size = sizeof(sweep_log_header_t);
+  header.record_size = (sizeof(sweep_log_header_t) + sweep_points * sizeof(sweep_log_point_t) + FF_MAX_SS - 1)&~(FF_MAX_SS-1);
+  header.seq         = log_seq++;
+  header.time        = rtc_get_tr_bin(); // TR read first
+  header.date        = rtc_get_dr_bin(); // DR read second
+  header.systime     = chVTGetSystemTimeX();
+  header.points      = sweep_points;
+  header.mask        = mask;
+  header.reserved    = 0;
+  if (res == FR_OK)
+    res = sd_card_log_write(&header, sizeof(header));
+  // Stop log on any SD card error
+  if (res != FR_OK) {
+    sd_card_log_stop();
+    return;
+  }
+  log_points = sweep_points;
+  log_index  = 0;
+}
+
+// Called from sweep after point measured and calibrated
+void sd_card_log_point(uint16_t idx)
+{
+  sweep_log_point_t p;
+  // Log started in middle of sweep, wait next record
+  if (idx != log_index || idx >= log_points)
+    return;
+  p.freq = frequencies[idx];
+  memcpy(p.data[0], measured[0][idx], sizeof(measured[0][idx]));
+  memcpy(p.data[1], measured[1][idx], sizeof(measured[1][idx]));
+  log_index++;
+  FRESULT res = sd_card_log_write(&p, sizeof(p));
+  if (res == FR_OK && log_index == log_points)
+    res = sd_card_log_end_record();
+  if (res != FR_OK)
+    sd_card_log_stop();
+}
+
+static UI_FUNCTION_ADV_CALLBACK(menu_sdcard_log_acb)
+{
+  (void)data;
+  if (b){
+    b->icon = sweep_mode&SWEEP_LOG ? BUTTON_ICON_CHECK : BUTTON_ICON_NOCHECK;
+    return;
+  }
+  if (sweep_mode&SWEEP_LOG) {
+    sd_card_log_stop();
+    draw_menu();
+    return;
+  }
+  // Create new log file, name generated from RTC time
+  uint32_t tr = rtc_get_tr_bcd(); // TR read first
+  uint32_t dr = rtc_get_dr_bcd(); // DR read second
+#if FF_USE_LFN >= 1
+  plot_printf(fs_filename, FF_LFN_BUF, "VNA_%06X_%06X.log", dr, tr);
+#else
+  plot_printf(fs_filename, FF_LFN_BUF, "%02X%06X.log", dr&0xFF, tr);
+#endif
+  log_seq = 0;
+  log_points = 0;
+  FRESULT res = f_mount(&log_volume, "", 1);
+  if (res == FR_OK)
+    res = f_open(&log_file, fs_filename, FA_CREATE_ALWAYS | FA_WRITE);
+  if (res == FR_OK)
+    sweep_mode|= SWEEP_LOG;
+  drawMessageBox("SWEEP LOG", res == FR_OK ? fs_filename : "  Fail write  ", 2000);
+  request_to_redraw_grid();
+  draw_menu();
+}
+#endif
+
 #define SAVE_S1P_FILE  1
 #define SAVE_S2P_FILE  2
 
-static const char s1_file_header[] =
-  "!File created by NanoVNA\r\n"\
-  "# Hz S RI R 50\r\n";
-
-static const char s1_file_param[] =
-  "%10u % f % f\r\n";
+// Touchstone data format names (index = VNA_MODE_S_FORMAT_x >> 3)
+static const char s_file_format[][3] = {"RI", "MA", "DB"};
 
-static const char s2_file_header[] =
+static const char s_file_header[] =
   "!File created by NanoVNA\r\n"\
-  "# Hz S RI R 50\r\n";
+  "# %s S %s R 50\r\n";
 
-static const char s2_file_param[] =
-  "%10u % f % f % f % f 0 0 0 0\r\n";
+// Convert S parameter to Touchstone pair (RI, MA or DB format)
+static void touchstone_value(float *v, const float *s, uint16_t format)
+{
+  if (format == VNA_MODE_S_FORMAT_RI) {
+    v[0] = s[0];
+    v[1] = s[1];
+    return;
+  }
+  float mag2 = s[0]*s[0] + s[1]*s[1];
+  // Limit to -200dB for zero values
+  v[0] = format == VNA_MODE_S_FORMAT_DB ? 10.0f * vna_log10f(mag2 + 1e-20f) : sqrtf(mag2);
+  v[1] = (180.0f / VNA_PI) * vna_atan2f(s[1], s[0]);
+}
+
+// Write S1P (ports = 1) or S2P (ports = 2) file data, lines formatted directly in fs_buffer
+// and written by FS_BUFFER_SIZE blocks (F072: 3072 bytes, 401 points RI S2P file ~37kB = 13 f_write)
+static FRESULT sd_card_save_touchstone(int ports)
+{
+  static const float s_zero[2] = {0.0f, 0.0f};
+  int i, j;
+  float v[2];
+  uint16_t format = config._mode&VNA_MODE_S_FORMAT_MASK;
+  bool mhz = config._mode&VNA_MODE_S_UNIT_MHZ;
+  fs_buffer_pos = 0;
+  FRESULT res = fs_buffer_commit(plot_printf((char *)fs_buffer, FS_LINE_MAX, s_file_header, mhz ? "MHz" : "Hz", s_file_format[format>>3]));
+  for (i = 0; i < sweep_points && res == FR_OK; i++) {
+    char *buf = (char *)&fs_buffer[fs_buffer_pos];
+    uint32_t f = frequencies[i];
+    int len = mhz ? plot_printf(buf, FS_LINE_MAX, "%4u.%06u", f / 1000000, f % 1000000)
+                  : plot_printf(buf, FS_LINE_MAX, "%10u", f);
+    // S11, S21, S12, S22 (S12 and S22 not measured, write as zero)
+    for (j = 0; j < (ports == 1 ? 1 : 4); j++) {
+      touchstone_value(v, j < 2 ? measured[j][i] : s_zero, format);
+      len+= plot_printf(buf + len, FS_LINE_MAX - len, " % f % f", v[0], v[1]);
+    }
+    len+= plot_printf(buf + len, FS_LINE_MAX - len, "\r\n");
+    res = fs_buffer_commit(len);
+  }
+  if (res == FR_OK)
+    res = fs_buffer_flush();
+  return res;
+}
 
 static UI_FUNCTION_CALLBACK(menu_sdcard_cb)
 {
-  char *buf = (char *)spi_buffer;
 //  shell_printf("S file\r\n");
-  FRESULT res = f_mount(fs_volume, "", 1);
+  FRESULT res = sd_card_mount();
 //  shell_printf("Mount = %d\r\n", res);
   if (res != FR_OK)
     return;
@@ -1134,42 +1413,18 @@ static UI_FUNCTION_CALLBACK(menu_sdcard_cb)
   plot_printf(fs_filename, FF_LFN_BUF, "%08X.s%dp", rtc_get_FAT(), data);
 #endif
 
-  int i;
-  UINT size;
-//  UINT total_size = 0;
 //  systime_t time = chVTGetSystemTimeX();
   res = f_open(fs_file, fs_filename, FA_CREATE_ALWAYS | FA_READ | FA_WRITE);
 //  shell_printf("Open %s, = %d\r\n", fs_filename, res);
   if (res == FR_OK){
-    // Write S1P file
-    if (data == SAVE_S1P_FILE){
-      // write s1p header (not write NULL terminate at end)
-      res = f_write(fs_file, s1_file_header, sizeof(s1_file_header)-1, &size);
-//      total_size+=size;
-      // Write all points data
-      for (i = 0; i < sweep_points && res == FR_OK; i++) {
-        size = plot_printf(buf, 128, s1_file_param, frequencies[i], measured[0][i][0], measured[0][i][1]);
-//        total_size+=size;
-        res = f_write(fs_file, buf, size, &size);
-      }
-    }
-    // Write S2P file
-    else if (data == SAVE_S2P_FILE){
-      // Write s2p header (not write NULL terminate at end)
-      res = f_write(fs_file, s2_file_header, sizeof(s2_file_header)-1, &size);
-//      total_size+=size;
-      // Write all points data
-      for (i = 0; i < sweep_points && res == FR_OK; i++) {
-        size = plot_printf(buf, 128, s2_file_param, frequencies[i], measured[0][i][0], measured[0][i][1], measured[1][i][0], measured[1][i][1]);
-//        total_size+=size;
-        res = f_write(fs_file, buf, size, &size);
-      }
-    }
-    res = f_close(fs_file);
+    // Write S1P or S2P file
+    res = sd_card_save_touchstone(data);
+    FRESULT close_res = f_close(fs_file);
+    if (res == FR_OK) res = close_res;
 //    shell_printf("Close = %d\r\n", res);
 //    testLog();
 //    time = chVTGetSystemTimeX() - time;
-//    shell_printf("Total time: %dms (write %d byte/sec)\r\n", time/10, total_size*10000/time);
+//    shell_printf("Total time: %dms (write %d byte/sec)\r\n", time/10, f_size(fs_file)*10000/time);
   }
 
   drawMessageBox("SAVE TRACE", res == FR_OK ? fs_filename : "  Fail write  ", 2000);
@@ -1177,9 +1432,217 @@ static UI_FUNCTION_CALLBACK(menu_sdcard_cb)
   ui_mode_normal();
 }
 
+static UI_FUNCTION_ADV_CALLBACK(menu_sdcard_format_acb)
+{
+  if (b){
+    b->icon = (config._mode&VNA_MODE_S_FORMAT_MASK) == data ? BUTTON_ICON_GROUP_CHECKED : BUTTON_ICON_GROUP;
+    return;
+  }
+  config._mode&=~VNA_MODE_S_FORMAT_MASK;
+  config._mode|=data;
+  draw_menu();
+}
+
+// Toggle config._mode flag (data = flag)
+static UI_FUNCTION_ADV_CALLBACK(menu_sdcard_mode_acb)
+{
+  if (b){
+    b->icon = config._mode&data ? BUTTON_ICON_CHECK : BUTTON_ICON_NOCHECK;
+    return;
+  }
+  config._mode^=data;
+  draw_menu();
+}
+
+#ifdef __USE_SD_CARD_CAL__
+//*******************************************************************************************
+// Calibration library on SD card: properties_t saved to CAL_nnn.cal files (same as flash slot data)
+// CAL.IDX file store sd_cal_index_t record for every file (at id * record size offset),
+// so list not need open all files
+//*******************************************************************************************
+#define SD_CAL_MAX           100
+#define SD_CAL_INDEX_MAGIC   0x58444943  // "CIDX"
+typedef struct {
+  uint32_t magic;
+  uint32_t start;
+  uint32_t stop;
+  uint16_t points;
+  uint16_t status;          // cal status
+  uint32_t date;            // rtc_get_dr_bin() 0x00YYMMDD
+  uint32_t time;            // rtc_get_tr_bin() 0x00HHMMSS
+} sd_cal_index_t;
+
+static const char sd_cal_index_file[] = "CAL.IDX";
+
+static FRESULT sd_card_cal_write(void)
+{
+  UINT size;
+  current_props.magic = CONFIG_MAGIC;
+  current_props.checksum = caldata_checksum();
+  return f_write(fs_file, &current_props, sizeof(properties_t), &size);
+}
+
+static FRESULT sd_card_cal_index_write(uint32_t id)
+{
+  UINT size;
+  sd_cal_index_t idx;
+  idx.magic      = SD_CAL_INDEX_MAGIC;
+  idx.start      = frequency0;
+  idx.stop       = frequency1;
+  idx.points     = sweep_points;
+  idx.status     = cal_status;
+  idx.time       = rtc_get_tr_bin(); // TR read first
+  idx.date       = rtc_get_dr_bin(); // DR read second
+  FRESULT res = f_open(fs_file, sd_cal_index_file, FA_OPEN_ALWAYS | FA_WRITE);
+  if (res != FR_OK)
+    return res;
+  res = f_lseek(fs_file, id * sizeof(sd_cal_index_t));
+  if (res == FR_OK)
+    res = f_write(fs_file, &idx, sizeof(idx), &size);
+  FRESULT close_res = f_close(fs_file);
+  return res == FR_OK ? close_res : res;
+}
+
+// Check file size, magic and checksum before load (current_props not changed)
+// properties_t not fit in spi_buffer, so file read and checked by FS_BUFFER_SIZE blocks in fs_buffer
+// (block and properties_t size aligned by 4, checksum word not split between blocks)
+static FRESULT sd_card_cal_check(void)
+{
+  UINT size;
+  uint32_t pos, len, value = 0;
+  if (f_size(fs_file) != sizeof(properties_t))
+    return FR_INVALID_OBJECT;
+  for (pos = 0; pos < sizeof(properties_t); pos+= len) {
+    len = sizeof(properties_t) - pos < FS_BUFFER_SIZE ? sizeof(properties_t) - pos : FS_BUFFER_SIZE;
+    FRESULT res = f_read(fs_file, fs_buffer, len, &size);
+    if (res != FR_OK)
+      return res;
+    if (size != len || (pos == 0 && ((properties_t *)fs_buffer)->magic != CONFIG_MAGIC))
+      return FR_INT_ERR;
+    // Last block end with checksum
+    if (pos + len == sizeof(properties_t))
+      len-= sizeof(uint32_t);
+    value = checksum_update(value, fs_buffer, len);
+  }
+  if (value != *(uint32_t *)&fs_buffer[len])
+    return FR_INT_ERR;
+  return f_lseek(fs_file, 0);
+}
+
+// Read checked file direct to current_props, cal data used from RAM after load
+static FRESULT sd_card_cal_read(void)
+{
+  UINT size;
+  FRESULT res = sd_card_cal_check();
+  if (res != FR_OK)
+    return res;
+  res = f_read(fs_file, &current_props, sizeof(properties_t), &size);
+  if (res == FR_OK && size != sizeof(properties_t))
+    res = FR_INT_ERR;
+  if (res != FR_OK) {
+    // Read error after check, current_props partially overwritten (old and file fields mix)
+    // Restore last flash slot if valid, else not apply mixed calibration
+    if (caldata_get(lastsaveid))
+      load_properties(lastsaveid);
+    else
+      cal_status = 0;
+    return res;
+  }
+  active_props = &current_props;
+  lastsaveid = NO_SAVE_SLOT;
+  update_sweep_range();
+  return FR_OK;
+}
+
+static void sd_card_cal_file(uint32_t id, bool save)
+{
+  FRESULT res = FR_INVALID_PARAMETER;
+  if (id >= SD_CAL_MAX)
+    goto done;
+  res = sd_card_mount();
+  if (res != FR_OK)
+    goto done;
+  plot_printf(fs_filename, FF_LFN_BUF, "CAL_%03d.cal", id);
+  res = f_open(fs_file, fs_filename, save ? FA_CREATE_ALWAYS | FA_WRITE : FA_OPEN_EXISTING | FA_READ);
+  if (res != FR_OK)
+    goto done;
+  res = save ? sd_card_cal_write() : sd_card_cal_read();
+  FRESULT close_res = f_close(fs_file);
+  if (res == FR_OK) res = close_res;
+  if (res == FR_OK && save)
+    res = sd_card_cal_index_write(id);
+done:
+  drawMessageBox(save ? "SAVE CAL" : "LOAD CAL", res == FR_OK ? fs_filename : "  Fail  ", 2000);
+  draw_cal_status();
+}
+
+// Show calibration library list from index file
+static UI_FUNCTION_CALLBACK(menu_sdcard_cal_list_cb)
+{
+  (void)data;
+  UINT size;
+  sd_cal_index_t idx;
+  int x = 5, y = 5, i;
+  char buf[48];
+  ili9341_set_foreground(LCD_FG_COLOR);
+  ili9341_set_background(LCD_BG_COLOR);
+  ili9341_clear_screen();
+  FRESULT res = sd_card_mount();
+  if (res == FR_OK)
+    res = f_open(fs_file, sd_cal_index_file, FA_OPEN_EXISTING | FA_READ);
+  if (res == FR_OK) {
+    for (i = 0; i < SD_CAL_MAX; i++) {
+      if (f_read(fs_file, &idx, sizeof(idx), &size) != FR_OK || size != sizeof(idx))
+        break;
+      if (idx.magic != SD_CAL_INDEX_MAGIC)
+        continue;
+      plot_printf(buf, sizeof(buf), "%03d %.3F-%.3F %3dp %c 20%02d/%02d/%02d %02d:%02d", i,
+        (float)idx.start, (float)idx.stop, idx.points, idx.status & CALSTAT_APPLY ? 'C' : '-',
+        RTC_DR_YEAR(idx.date), RTC_DR_MONTH(idx.date), RTC_DR_DAY(idx.date), (idx.time>>16)&0xFF, (idx.time>>8)&0xFF);
+      ili9341_drawstring(buf, x, y);
+      y+= FONT_STR_HEIGHT;
+      if (y > LCD_HEIGHT - FONT_STR_HEIGHT)
+        break;
+    }
+    f_close(fs_file);
+  }
+  else
+    ili9341_drawstring("No calibration index", x, y);
+  while (true) {
+    if (touch_check() == EVT_TOUCH_PRESSED)
+      break;
+    if (btn_check() & EVT_BUTTON_SINGLE_CLICK)
+      break;
+    chThdSleepMilliseconds(40);
+  }
+  redraw_frame();
+  request_to_redraw_grid();
+  ui_mode_normal();
+}
+#endif
+
+static const menuitem_t menu_sdcard_format[] = {
+  { MT_ADV_CALLBACK, VNA_MODE_S_FORMAT_RI, "RI", menu_sdcard_format_acb },
+  { MT_ADV_CALLBACK, VNA_MODE_S_FORMAT_MA, "MA", menu_sdcard_format_acb },
+  { MT_ADV_CALLBACK, VNA_MODE_S_FORMAT_DB, "DB", menu_sdcard_format_acb },
+  { MT_ADV_CALLBACK, VNA_MODE_S_UNIT_MHZ, "MHz", menu_sdcard_mode_acb },
+  { MT_ADV_CALLBACK, VNA_MODE_BMP_RLE, "RLE BMP", menu_sdcard_mode_acb },
+  { MT_CANCEL,   0, S_LARROW" BACK", NULL },
+  { MT_NONE,     0, NULL, NULL } // sentinel
+};
+
 static const menuitem_t menu_sdcard[] = {
   { MT_CALLBACK, SAVE_S1P_FILE, "SAVE S1P", menu_sdcard_cb },
   { MT_CALLBACK, SAVE_S2P_FILE, "SAVE S2P", menu_sdcard_cb },
+  { MT_SUBMENU,  0, "FORMAT", menu_sdcard_format },
+#ifdef __USE_SD_CARD_LOG__
+  { MT_ADV_CALLBACK, 0, "LOG SWEEP", menu_sdcard_log_acb },
+#endif
+#ifdef __USE_SD_CARD_CAL__
+  { MT_CALLBACK, KM_SD_CAL_SAVE, "SAVE CAL", menu_keyboard_cb },
+  { MT_CALLBACK, KM_SD_CAL_LOAD, "LOAD CAL", menu_keyboard_cb },
+  { MT_CALLBACK, 0, "LIST CAL", menu_sdcard_cal_list_cb },
+#endif
   { MT_CANCEL,   0, S_LARROW" BACK", NULL },
   { MT_NONE,     0, NULL, NULL } // sentinel
 };
@@ -1197,40 +1660,40 @@ static const menuitem_t menu_calop[] = {
 };
 
 const menuitem_t menu_save[] = {
-  { MT_ADV_CALLBACK, 0, "SAVE %d", menu_save_acb },
-  { MT_ADV_CALLBACK, 1, "SAVE %d", menu_save_acb },
-  { MT_ADV_CALLBACK, 2, "SAVE %d", menu_save_acb },
+  { MT_ADV_CALLBACK, 0, "SAVE %d\n%s", menu_save_acb },
+  { MT_ADV_CALLBACK, 1, "SAVE %d\n%s", menu_save_acb },
+  { MT_ADV_CALLBACK, 2, "SAVE %d\n%s", menu_save_acb },
 #if SAVEAREA_MAX > 3
-  { MT_ADV_CALLBACK, 3, "SAVE %d", menu_save_acb },
+  { MT_ADV_CALLBACK, 3, "SAVE %d\n%s", menu_save_acb },
 #endif
 #if SAVEAREA_MAX > 4
-  { MT_ADV_CALLBACK, 4, "SAVE %d", menu_save_acb },
+  { MT_ADV_CALLBACK, 4, "SAVE %d\n%s", menu_save_acb },
 #endif
 #if SAVEAREA_MAX > 5
-  { MT_ADV_CALLBACK, 5, "SAVE %d", menu_save_acb },
+  { MT_ADV_CALLBACK, 5, "SAVE %d\n%s", menu_save_acb },
 #endif
 #if SAVEAREA_MAX > 6
-  { MT_ADV_CALLBACK, 6, "SAVE %d", menu_save_acb },
+  { MT_ADV_CALLBACK, 6, "SAVE %d\n%s", menu_save_acb },
 #endif
   { MT_CANCEL, 0, S_LARROW" BACK", NULL },
   { MT_NONE, 0, NULL, NULL } // sentinel
 };
 
 const menuitem_t menu_recall[] = {
-  { MT_ADV_CALLBACK, 0, "RECALL %d", menu_recall_acb },
-  { MT_ADV_CALLBACK, 1, "RECALL %d", menu_recall_acb },
-  { MT_ADV_CALLBACK, 2, "RECALL %d", menu_recall_acb },
+  { MT_ADV_CALLBACK, 0, "RECALL %d\n%s", menu_recall_acb },
+  { MT_ADV_CALLBACK, 1, "RECALL %d\n%s", menu_recall_acb },
+  { MT_ADV_CALLBACK, 2, "RECALL %d\n%s", menu_recall_acb },
 #if SAVEAREA_MAX > 3
-  { MT_ADV_CALLBACK, 3, "RECALL %d", menu_recall_acb },
+  { MT_ADV_CALLBACK, 3, "RECALL %d\n%s", menu_recall_acb },
 #endif
 #if SAVEAREA_MAX > 4
-  { MT_ADV_CALLBACK, 4, "RECALL %d", menu_recall_acb },
+  { MT_ADV_CALLBACK, 4, "RECALL %d\n%s", menu_recall_acb },
 #endif
 #if SAVEAREA_MAX > 5
-  { MT_ADV_CALLBACK, 5, "RECALL %d", menu_recall_acb },
+  { MT_ADV_CALLBACK, 5, "RECALL %d\n%s", menu_recall_acb },
 #endif
 #if SAVEAREA_MAX > 6
-  { MT_ADV_CALLBACK, 6, "RECALL %d", menu_recall_acb },
+  { MT_ADV_CALLBACK, 6, "RECALL %d\n%s", menu_recall_acb },
 #endif
   { MT_CANCEL, 0, S_LARROW" BACK", NULL },
   { MT_NONE, 0, NULL, NULL } // sentinel
@@ -1252,6 +1715,7 @@ const menuitem_t menu_cal[] = {
   { MT_SUBMENU,      0, "SAVE",      menu_save },
   { MT_CALLBACK,     0, "RESET",     menu_cal_reset_cb },
   { MT_ADV_CALLBACK, 0, "APPLY",     menu_cal_apply_acb },
+  { MT_ADV_CALLBACK, 0, "AUTO\nSELECT", menu_cal_auto_acb },
   { MT_CANCEL, 0, S_LARROW" BACK", NULL },
   { MT_NONE, 0, NULL, NULL } // sentinel
 };
@@ -1307,9 +1771,49 @@ const menuitem_t menu_transform_window[] = {
   { MT_ADV_CALLBACK, TD_WINDOW_MINIMUM, "MINIMUM", menu_transform_window_acb },
   { MT_ADV_CALLBACK, TD_WINDOW_NORMAL,   "NORMAL", menu_transform_window_acb },
   { MT_ADV_CALLBACK, TD_WINDOW_MAXIMUM, "MAXIMUM", menu_transform_window_acb },
+  { MT_ADV_CALLBACK, TD_WINDOW_HANN,       "HANN", menu_transform_window_acb },
+  { MT_ADV_CALLBACK, TD_WINDOW_BLACKMAN, "BLACKMAN", menu_transform_window_acb },
+  { MT_CANCEL, 0, S_LARROW" BACK", NULL },
+  { MT_NONE, 0, NULL, NULL } // sentinel
+};
+
+#ifdef __USE_TD_ZOOM__
+static UI_FUNCTION_CALLBACK(menu_transform_zoom_off_cb)
+{
+  (void)data;
+  td_zoom_start = td_zoom_stop = 0.0f;
+  redraw_request|= REDRAW_FREQUENCY | REDRAW_MARKER;
+  menu_move_back(false);
+}
+#endif
+
+#ifdef __USE_TD_GATE__
+static UI_FUNCTION_CALLBACK(menu_transform_gate_off_cb)
+{
+  (void)data;
+  td_gate_start = td_gate_stop = 0.0f;
+  redraw_request|= REDRAW_CAL_STATUS;
+  menu_move_back(false);
+}
+#endif
+
+#if defined(__USE_TD_ZOOM__) || defined(__USE_TD_GATE__)
+// Time window settings (zoom and gate share one submenu, transform menu is full)
+const menuitem_t menu_transform_zoom[] = {
+#ifdef __USE_TD_ZOOM__
+  { MT_CALLBACK, KM_TD_ZOOM_START, "ZOOM\nSTART", menu_keyboard_cb },
+  { MT_CALLBACK, KM_TD_ZOOM_STOP,  "ZOOM\nSTOP",  menu_keyboard_cb },
+  { MT_CALLBACK, 0,                "ZOOM OFF",    menu_transform_zoom_off_cb },
+#endif
+#ifdef __USE_TD_GATE__
+  { MT_CALLBACK, KM_TD_GATE_START, "GATE\nSTART", menu_keyboard_cb },
+  { MT_CALLBACK, KM_TD_GATE_STOP,  "GATE\nSTOP",  menu_keyboard_cb },
+  { MT_CALLBACK, 0,                "GATE OFF",    menu_transform_gate_off_cb },
+#endif
   { MT_CANCEL, 0, S_LARROW" BACK", NULL },
   { MT_NONE, 0, NULL, NULL } // sentinel
 };
+#endif
 
 const menuitem_t menu_transform[] = {
   { MT_ADV_CALLBACK, 0, "TRANSFORM\nON", menu_transform_acb },
@@ -1317,6 +1821,13 @@ const menuitem_t menu_transform[] = {
   { MT_ADV_CALLBACK, TD_FUNC_LOWPASS_STEP, "LOW PASS\nSTEP", menu_transform_filter_acb },
   { MT_ADV_CALLBACK, TD_FUNC_BANDPASS, "BANDPASS", menu_transform_filter_acb },
   { MT_SUBMENU, 0, "WINDOW", menu_transform_window },
+#if defined(__USE_TD_ZOOM__) && defined(__USE_TD_GATE__)
+  { MT_SUBMENU, 0, "ZOOM\nGATE", menu_transform_zoom },
+#elif defined(__USE_TD_ZOOM__)
+  { MT_SUBMENU, 0, "ZOOM", menu_transform_zoom },
+#elif defined(__USE_TD_GATE__)
+  { MT_SUBMENU, 0, "GATE", menu_transform_zoom },
+#endif
   { MT_CALLBACK, KM_VELOCITY_FACTOR, "VELOCITY\nFACTOR", menu_keyboard_cb },
   { MT_CANCEL, 0, S_LARROW" BACK", NULL },
   { MT_NONE, 0, NULL, NULL } // sentinel
@@ -1673,6 +2184,25 @@ static const keypads_t keypads_scale[] = {
   { 0, 0, KP_NONE }
 };
 
+#ifdef __USE_SD_CARD_CAL__
+// Integer input (file number), no period
+static const keypads_t keypads_index[] = {
+  { 0, 3, KP_0 },
+  { 0, 2, KP_1 },
+  { 1, 2, KP_2 },
+  { 2, 2, KP_3 },
+  { 0, 1, KP_4 },
+  { 1, 1, KP_5 },
+  { 2, 1, KP_6 },
+  { 0, 0, KP_7 },
+  { 1, 0, KP_8 },
+  { 2, 0, KP_9 },
+  { 3, 3, KP_X1 },
+  { 2, 3, KP_BS },
+  { 0, 0, KP_NONE }
+};
+#endif
+
 static const keypads_t keypads_time[] = {
   { 1, 3, KP_PERIOD },
   { 0, 3, KP_0 },
@@ -1702,7 +2232,19 @@ static const keypads_list keypads_mode_tbl[KM_NONE] = {
 [KM_REFPOS]          = {keypads_scale, "REFPOS"   }, // refpos
 [KM_EDELAY]          = {keypads_time , "EDELAY"   }, // electrical delay
 [KM_VELOCITY_FACTOR] = {keypads_scale, "VELOCITY%"}, // velocity factor
-[KM_SCALEDELAY]      = {keypads_time , "DELAY"    }  // scale of delay
+[KM_SCALEDELAY]      = {keypads_time , "DELAY"    }, // scale of delay
+#ifdef __USE_SD_CARD_CAL__
+[KM_SD_CAL_SAVE]     = {keypads_index, "SAVE CAL" }, // SD card cal file number
+[KM_SD_CAL_LOAD]     = {keypads_index, "LOAD CAL" }, // SD card cal file number
+#endif
+#ifdef __USE_TD_ZOOM__
+[KM_TD_ZOOM_START]   = {keypads_time , "ZOOM START"}, // time domain zoom start
+[KM_TD_ZOOM_STOP]    = {keypads_time , "ZOOM STOP" }, // time domain zoom stop
+#endif
+#ifdef __USE_TD_GATE__
+[KM_TD_GATE_START]   = {keypads_time , "GATE START"}, // time domain gate start
+[KM_TD_GATE_STOP]    = {keypads_time , "GATE STOP" }, // time domain gate stop
+#endif
 };
 
 static void
@@ -1904,7 +2446,7 @@ draw_menu_buttons(const menuitem_t *menu)
       if (cb) (*cb)(menu[i].data, &button);
     }
     char button_text[32];
-    plot_printf(button_text, sizeof(button_text), menu[i].label, button.p1.u, button.p1.u);
+    plot_printf(button_text, sizeof(button_text), menu[i].label, button.p1.u, button.p2.u);
     draw_button(LCD_WIDTH-MENU_BUTTON_WIDTH, y, MENU_BUTTON_WIDTH, MENU_BUTTON_HEIGHT, &button);
 
     ili9341_set_foreground(button.fg);
@@ -1962,6 +2504,14 @@ draw_menu(void)
   draw_menu_buttons(menu_stack[menu_current_level]);
 }
 
+// Draw menu if shown (used for screen render)
+void
+ui_draw_menu(void)
+{
+  if (ui_mode == UI_MENU)
+    draw_menu();
+}
+
 static void
 erase_menu_buttons(void)
 {
@@ -2458,6 +3008,30 @@ keypad_click(int key)
     case KM_SCALEDELAY:
       set_trace_scale(current_trace, value * 1e-12); // pico second
       break;
+#ifdef __USE_TD_ZOOM__
+    case KM_TD_ZOOM_START:
+      td_zoom_start = value * 1e-12; // pico seconds
+      break;
+    case KM_TD_ZOOM_STOP:
+      td_zoom_stop  = value * 1e-12; // pico seconds
+      break;
+#endif
+#ifdef __USE_TD_GATE__
+    case KM_TD_GATE_START:
+      td_gate_start = value * 1e-12; // pico seconds
+      redraw_request|= REDRAW_CAL_STATUS;
+      break;
+    case KM_TD_GATE_STOP:
+      td_gate_stop  = value * 1e-12; // pico seconds
+      redraw_request|= REDRAW_CAL_STATUS;
+      break;
+#endif
+#ifdef __USE_SD_CARD_CAL__
+    case KM_SD_CAL_SAVE:
+    case KM_SD_CAL_LOAD:
+      sd_card_cal_file((uint32_t)value, keypad_mode == KM_SD_CAL_SAVE);
+      break;
+#endif
     }
     return KP_DONE;
   }
@@ -2634,54 +3208,33 @@ touch_pickup_marker(int touch_x, int touch_y)
 }
 
 #ifdef __USE_SD_CARD__
-//*******************************************************************************************
-// Bitmap file header for LCD_WIDTH x LCD_HEIGHT image 16bpp (v4 format allow set RGB mask)
-//*******************************************************************************************
-#define BMP_UINT32(val)  ((val)>>0)&0xFF, ((val)>>8)&0xFF, ((val)>>16)&0xFF, ((val)>>24)&0xFF
-#define BMP_H1_SIZE      (14)                        // BMP header 14 bytes
-#define BMP_V4_SIZE      (56)                        // v4  header 56 bytes
-#define BMP_HEAD_SIZE    (BMP_H1_SIZE + BMP_V4_SIZE) // Size of all headers
-#define BMP_SIZE         (2*LCD_WIDTH*LCD_HEIGHT)    // Bitmap size = 2*w*h
-#define BMP_FILE_SIZE    (BMP_SIZE + BMP_HEAD_SIZE)  // File size = headers + bitmap
-static const uint8_t bmp_header_v4[14+56] = {
-// BITMAPFILEHEADER (14 byte size)
-  0x42, 0x4D,                // BM signature
-  BMP_UINT32(BMP_FILE_SIZE), // File size (h + v4 + bitmap)
-  0x00, 0x00,                // reserved
-  0x00, 0x00,                // reserved
-  BMP_UINT32(BMP_HEAD_SIZE), // Size of all headers (h + v4)
-// BITMAPINFOv4 (56 byte size)
-  BMP_UINT32(BMP_V4_SIZE),   // Data offset after this point (v4 size)
-  BMP_UINT32(LCD_WIDTH),     // Width
-  BMP_UINT32(LCD_HEIGHT),    // Height
-  0x01, 0x00,                // Planes
-  0x10, 0x00,                // 16bpp
-  0x03, 0x00, 0x00, 0x00,    // Compression (BI_BITFIELDS)
-  BMP_UINT32(BMP_SIZE),      // Bitmap size (w*h*2)
-  0xC4, 0x0E, 0x00, 0x00,    // x Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
-  0xC4, 0x0E, 0x00, 0x00,    // y Resolution (96 DPI = 96 * 39.3701 inches per metre = 0x0EC4)
-  0x00, 0x00, 0x00, 0x00,    // Palette size
-  0x00, 0x00, 0x00, 0x00,    // Palette used
-// Extend v4 header data (color mask for RGB565)
-  0x00, 0xF8, 0x00, 0x00,    // R mask = 0b11111000 00000000
-  0xE0, 0x07, 0x00, 0x00,    // G mask = 0b00000111 11100000
-  0x1F, 0x00, 0x00, 0x00,    // B mask = 0b00000000 00011111
-  0x00, 0x00, 0x00, 0x00     // A mask = 0b00000000 00000000
-};
+// Screenshot data write to file
+static bool screenshot_write(const void *data, uint16_t size)
+{
+  UINT bw;
+  return f_write(fs_file, data, size, &bw) == FR_OK;
+}
+
+// Set BMP header value in file
+static FRESULT screenshot_set_header(uint32_t offset, uint32_t value)
+{
+  UINT bw;
+  FRESULT res = f_lseek(fs_file, offset);
+  if (res == FR_OK)
+    res = f_write(fs_file, &value, sizeof(value), &bw);
+  return res;
+}
 
 static int
 made_screenshot(int touch_x, int touch_y)
 {
-  int y, i;
-  UINT size;
   if (touch_y < HEIGHT || touch_x < FREQUENCIES_XPOS3 || touch_x > FREQUENCIES_XPOS2)
     return FALSE;
   touch_wait_release();
 //  uint32_t time = chVTGetSystemTimeX();
 //  shell_printf("Screenshot\r\n");
-  FRESULT res = f_mount(fs_volume, "", 1);
+  FRESULT res = sd_card_mount();
   // fs_volume, fs_file and fs_filename stored at end of spi_buffer!!!!!
-  uint16_t *buf = (uint16_t *)spi_buffer;
 //  shell_printf("Mount = %d\r\n", res);
   if (res != FR_OK)
     return TRUE;
@@ -2695,19 +3248,23 @@ made_screenshot(int touch_x, int touch_y)
   res = f_open(fs_file, fs_filename, FA_CREATE_ALWAYS | FA_READ | FA_WRITE);
 //  shell_printf("Open %s, result = %d\r\n", fs_filename, res);
   if (res == FR_OK){
-    res = f_write(fs_file, bmp_header_v4, sizeof(bmp_header_v4), &size);
-    for (y = LCD_HEIGHT-1; y >= 0 && res == FR_OK; y--) {
-      ili9341_read_memory(0, y, LCD_WIDTH, 1, buf);
-      for (i = 0; i < LCD_WIDTH; i++)
-        buf[i] = __REVSH(buf[i]); // swap byte order (example 0x10FF to 0xFF10)
-      res = f_write(fs_file, buf, LCD_WIDTH*sizeof(uint16_t), &size);
-    }
-    res = f_close(fs_file);
+    // Write raw 16bpp BMP, or RLE8 compressed if enabled, screen rendered without LCD
+    // read (render use only palette colors, so RLE8 not lost colors)
+    bool rle8 = (config._mode&VNA_MODE_BMP_RLE) != 0;
+    uint32_t size = lcd_screenshot_bmp(screenshot_write, rle8, true);
+    res = size ? FR_OK : FR_DISK_ERR;
+    // Set file and image size in RLE8 header
+    if (res == FR_OK && rle8)
+      res = screenshot_set_header(BMP_FILE_SIZE_OFFSET, size);
+    if (res == FR_OK && rle8)
+      res = screenshot_set_header(BMP_IMAGE_SIZE_OFFSET, size - BMP_RLE8_DATA_OFFSET);
+    FRESULT close_res = f_close(fs_file);
+    if (res == FR_OK) res = close_res;
 //    shell_printf("Close %d\r\n", res);
 //    testLog();
   }
 //  time = chVTGetSystemTimeX() - time;
-//  shell_printf("Total time: %dms (write %d byte/sec)\r\n", time/10, (LCD_WIDTH*LCD_HEIGHT*sizeof(uint16_t)+sizeof(bmp_header_v4))*10000/time);
+//  shell_printf("Total time: %dms (write %d byte/sec)\r\n", time/10, f_size(fs_file)*10000/time);
   drawMessageBox("SCREENSHOT", res == FR_OK ? fs_filename : "  Fail write  ", 2000);
   request_to_redraw_grid();
   return TRUE;